@@ -51,6 +51,23 @@
 		(d).Each derived class implements its contribution for handling the request.
 		(e).If the request needs to be "passed on", then the derived class "calls back" to the base class, which delegates to the "next" pointer.
 		(f).The client (or some third party) creates and links the chain (which may include a link from the last node to the root node).
+		(g).Long chains can be "compiled" once the wiring is finished: a dense key -> handler table turns handle() into a
+			single indexed call. A setNext() on any handler of that chain invalidates its table, and the next handle()
+			recompiles it; the tables of other chains are left alone.
+		(h).The walk is a loop driven by the base class rather than a recursion through the handlers, so chain length
+			costs no stack. Uncompiled chains walk, and walk() is always available where pass() notifications matter. Requests nobody handles go to a configurable sink, and each handler counts its hits and passes.
+		(i).Bursts of requests can be handed over as a span: they are partitioned by handler with a counting sort over
+			the compiled table, and each handler then processes one contiguous slice.
+		(j).PipelinedChain runs every handler on its own thread and forwards unhandled requests through bounded
+			single-producer/single-consumer rings, so a long chain spreads across cores. Full rings apply backpressure.
+		(k).AdaptiveChain samples which handler takes each request and periodically moves hot handlers forward among
+			those declared order-independent, publishing the new order as an atomically swapped snapshot. It watches
+			the wiring like a compiled table does, and takes the order afresh after any handler on it is rewired.
+		(l).When the handlers are known at build time, Chain<Handler1, Handler2, Handler3> folds them into a single
+			inlinable decision sequence with no next pointers and no virtual calls.
+
+	Build:
+		g++ -std=c++20 -O2 -pthread ChainOfResponsibility.cpp
 
 	Example:
 		-> ATM machine
@@ -58,73 +75,1128 @@
 
 #include <iostream>
 #include <vector>
+#include <span>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <climits>
+#include <string>
+#include <ctime>
+#include <unordered_set>
 
 namespace Demo1
 {
+	class Base;
+	class AdaptiveChain;
+
+	//Key -> handler table compiled from one chain. It lives outside the handlers so that a handler stays a few
+	//words, and every handler on the chain links a Watch back to it, so rewiring any of them marks exactly the
+	//tables that walk through that handler stale, not the tables of unrelated chains.
+	class CompiledChain
+	{
+		friend class Base;
+		friend class AdaptiveChain;
+
+		struct Watch
+		{
+			CompiledChain *table;
+			Base *node;		// null once the handler has been destroyed
+			Watch *next;	// next table watching the same handler
+		};
+
+		// slot[key - minKey] is an index into order, or -1 when no handler owns the key.
+		// Keys spread over more than MAX_DENSE_RANGE values go to sparse instead, (key, index) pairs sorted by key.
+		enum { MAX_DENSE_RANGE = 1 << 16 };
+		std::atomic<bool> stale;	// read by every dispatching thread of an AdaptiveChain
+		bool routing;	// handle(int) dispatches through the table; set by Base::compile(), not by a batch
+		int minKey;
+		std::vector<int> slot;
+		std::vector<std::pair<int, int> > sparse;
+		std::vector<Base*> order;
+		std::vector<Watch> watches;	// one per entry of order, sized before linking so the cells never move
+
+		// Scratch space for batch dispatch, kept between calls so a burst does not allocate.
+		std::vector<int> batchOwner;
+		std::vector<int> batchStart;
+		std::vector<int> batchKeys;
+
+		void compile(Base *root);
+		void unwatch();
+	  public:
+		CompiledChain()
+		{
+			stale = true;
+			routing = false;
+			minKey = 0;
+		}
+		~CompiledChain()
+		{
+			unwatch();
+		}
+		// Index into order of the handler owning the key, or -1.
+		int owner(int i) const
+		{
+			if (!slot.empty())
+			{
+				unsigned int idx = (unsigned int)i - (unsigned int)minKey;
+				return idx < slot.size() ? slot[idx] : -1;
+			}
+			std::vector<std::pair<int, int> >::const_iterator it =
+				std::lower_bound(sparse.begin(), sparse.end(), std::make_pair(i, INT_MIN));
+			return (it != sparse.end() && it->first == i) ? it->second : -1;
+		}
+	};
+
 	class Base
 	{
+		friend class CompiledChain;
+	  public:
+		typedef void (*Sink)(int);
+	  private:
 		Base *next;
+		Sink unhandled;
+		unsigned long hits;
+		unsigned long passes;
+
+		// The table compiled with this handler as the root, and the tables of every chain running through it.
+		std::unique_ptr<CompiledChain> table;
+		CompiledChain::Watch *watchers;
+		bool orderIndependent;	// last, so a derived handler's own small fields can share its padding
+
+		void invalidate()
+		{
+			for (CompiledChain::Watch *w = watchers; w; w = w->next)
+				w->table->stale = true;
+		}
 	  public:
 		Base()
 		{
 			next = 0;
+			unhandled = &Base::defaultSink;
+			orderIndependent = false;
+			hits = 0;
+			passes = 0;
+			watchers = 0;
+		}
+		// A copy takes the wiring and counters but none of the compiled tables of the original.
+		Base(const Base &o)
+		{
+			next = o.next;
+			unhandled = o.unhandled;
+			orderIndependent = o.orderIndependent;
+			hits = o.hits;
+			passes = o.passes;
+			watchers = 0;
+		}
+		Base &operator=(const Base &o)
+		{
+			if (this != &o)
+			{
+				setNext(o.next);
+				unhandled = o.unhandled;
+				orderIndependent = o.orderIndependent;
+				hits = o.hits;
+				passes = o.passes;
+			}
+			return *this;
+		}
+		virtual ~Base()
+		{
+			for (CompiledChain::Watch *w = watchers; w; w = w->next)
+			{
+				w->node = 0;
+				w->table->stale = true;
+			}
+			table.reset();
 		}
 		void setNext(Base *n)
 		{
 			next = n;
+			invalidate();
+		}
+		Base *getNext() const
+		{
+			return next;
+		}
+		// The handlers a walk from here visits, in order and each once. A chain linked back on itself (see (f))
+		// ends just before the first handler it would reach a second time.
+		std::vector<Base*> chain()
+		{
+			std::vector<Base*> nodes;
+			std::unordered_set<const Base*> seen;
+			for (Base *n = this; n && seen.insert(n).second; n = n->next)
+				nodes.push_back(n);
+			return nodes;
+		}
+		// Declares that this handler's keys never overlap a neighbour's, so it may be moved within the chain.
+		void setOrderIndependent(bool b)
+		{
+			orderIndependent = b;
+		}
+		bool isOrderIndependent() const
+		{
+			return orderIndependent;
 		}
-		virtual void handle(int i)
+		// Where requests that fall off the end of the chain go; the sink of the node the walk starts from is used.
+		void setUnhandled(Sink s)
 		{
-			next->handle(i);
+			unhandled = s ? s : &Base::defaultSink;
+		}
+		unsigned long getHits() const
+		{
+			return hits;
+		}
+		unsigned long getPasses() const
+		{
+			return passes;
+		}
+		// Once compile() has been called this is a single indexed call to the responsible handler, recompiling
+		// first if the chain was rewired. Before that it walks. Only the walk calls pass() and counts passes.
+		void handle(int i)
+		{
+			if (!table || !table->routing)
+			{
+				walk(i);
+				return;
+			}
+			if (table->stale)
+				table->compile(this);
+			int o = table->owner(i);
+			if (-1 != o)
+			{
+				Base *h = table->order[o];
+				++h->hits;
+				h->process(i);
+			}
+			else
+				unhandled(i);
+		}
+		// Walks the chain with a loop rather than recursion, so chain length does not consume stack.
+		void walk(int i)
+		{
+			for (Base *n = this; n; n = n->next)
+			{
+				if (n->key() == i)
+				{
+					++n->hits;
+					n->process(i);
+					return;
+				}
+				++n->passes;
+				n->pass(i);
+			}
+			unhandled(i);
+		}
+		// The request key this handler is responsible for.
+		virtual int key() const = 0;
+		// Does the actual work once the handler has been found.
+		virtual void process(int i) = 0;
+		// Processes a contiguous slice of requests that all belong to this handler. Handlers override it
+		// when they can do the slice for less than one process() call per request.
+		virtual void processBatch(std::span<const int> keys)
+		{
+			for (size_t k = 0; k < keys.size(); k++)
+				process(keys[k]);
+		}
+		// Notification that the request is being passed on to the successor.
+		virtual void pass(int)
+		{
+		}
+		static void defaultSink(int i)
+		{
+			std::cout << "Unhandled " << i << std::endl;
+		}
+
+		// Builds the key -> handler table for the chain starting here; from then on handle() dispatches through it.
+		void compile()
+		{
+			if (!table)
+				table.reset(new CompiledChain);
+			table->compile(this);
+			table->routing = true;
+		}
+		bool isCompiled() const
+		{
+			return table && table->routing && !table->stale;
+		}
+		// Batch entry point: one pass sorts the whole burst by responsible handler (stable, so each
+		// handler sees its requests in arrival order), then every handler processes its own slice.
+		// The batch builds and keeps the table it partitions with, but handle(int) goes on walking
+		// until compile() is called.
+		void handle(std::span<const int> keys)
+		{
+			if (!table)
+				table.reset(new CompiledChain);
+			if (table->stale)
+				table->compile(this);
+			CompiledChain &t = *table;
+			std::vector<int> &batchOwner = t.batchOwner;
+			std::vector<int> &batchStart = t.batchStart;
+			std::vector<int> &batchKeys = t.batchKeys;
+
+			const int n = (int)keys.size();
+			const int buckets = (int)t.order.size() + 1;	// last bucket collects the unhandled requests
+			batchOwner.resize(n);
+			batchKeys.resize(n);
+			batchStart.assign(buckets + 1, 0);
+
+			for (int k = 0; k < n; k++)
+			{
+				int h = t.owner(keys[k]);
+				batchOwner[k] = h < 0 ? buckets - 1 : h;
+			}
+			for (int k = 0; k < n; k++)
+				++batchStart[batchOwner[k] + 1];
+			for (int b = 0; b < buckets; b++)
+				batchStart[b + 1] += batchStart[b];
+			for (int k = 0; k < n; k++)
+				batchKeys[batchStart[batchOwner[k]]++] = keys[k];
+
+			// The scatter advanced every start to the end of its bucket, so a bucket runs from the previous end to its own
+			int begin = 0;
+			for (int b = 0; b < buckets; b++)
+			{
+				int end = batchStart[b];
+				if (end == begin)
+					continue;
+				std::span<const int> slice(batchKeys.data() + begin, end - begin);
+				if (b == buckets - 1)
+				{
+					for (size_t k = 0; k < slice.size(); k++)
+						unhandled(slice[k]);
+				}
+				else
+				{
+					t.order[b]->hits += slice.size();
+					t.order[b]->processBatch(slice);
+				}
+				begin = end;
+			}
 		}
 	};
 
-	class Handler1: public Base
+	// Walks the chain once and builds the table. The first handler on the chain that owns a key wins, as it
+	// would when walking, and a cycle back into the chain is cut where it closes.
+	void CompiledChain::compile(Base *root)
 	{
-	  public:
-		void handle(int i)
+		unwatch();
+		slot.clear();
+		sparse.clear();
+
+		order = root->chain();
+		int maxKey = root->key();
+		minKey = root->key();
+		for (size_t h = 0; h < order.size(); h++)
+		{
+			if (order[h]->key() < minKey)
+				minKey = order[h]->key();
+			if (order[h]->key() > maxKey)
+				maxKey = order[h]->key();
+		}
+		watches.resize(order.size());
+		for (size_t h = 0; h < order.size(); h++)
 		{
-			if (1 != i)
+			Watch w = {this, order[h], order[h]->watchers};
+			watches[h] = w;
+			order[h]->watchers = &watches[h];
+		}
+
+		long long range = (long long)maxKey - minKey + 1;
+		if (range <= MAX_DENSE_RANGE)
+		{
+			slot.assign((size_t)range, -1);
+			for (int h = 0; h < (int)order.size(); h++)
 			{
-				std::cout << "H1 passed " << i << "  ";
-				Base::handle(i);
+				int &s = slot[(unsigned int)order[h]->key() - (unsigned int)minKey];
+				if (-1 == s)
+					s = h;
 			}
-			else
-			  std::cout << "H1 handled " << i << std::endl;
+		}
+		else
+		{
+			for (int h = 0; h < (int)order.size(); h++)
+				sparse.push_back(std::make_pair(order[h]->key(), h));
+			// Stable, so the first of equal keys is the earliest handler; unique keeps exactly that one
+			std::stable_sort(sparse.begin(), sparse.end(),
+				[](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first < b.first; });
+			sparse.erase(std::unique(sparse.begin(), sparse.end(),
+				[](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first == b.first; }),
+				sparse.end());
+		}
+		stale = false;
+	}
+
+	// Takes this table's cells off the watcher lists of the handlers that are still alive.
+	void CompiledChain::unwatch()
+	{
+		for (size_t w = 0; w < watches.size(); w++)
+		{
+			Base *n = watches[w].node;
+			if (!n)
+				continue;
+			Watch **link = &n->watchers;
+			while (*link != &watches[w])
+				link = &(*link)->next;
+			*link = watches[w].next;
+		}
+		watches.clear();
+	}
+
+	//Bounded single-producer/single-consumer ring; Capacity must be a power of two
+	template <typename T, size_t Capacity>
+	class SpscRing
+	{
+		T items[Capacity];
+		alignas(64) std::atomic<size_t> head;	// next slot to pop, owned by the consumer
+		alignas(64) std::atomic<size_t> tail;	// next slot to push, owned by the producer
+	  public:
+		SpscRing(): head(0), tail(0)
+		{
+		}
+		bool tryPush(const T &item)
+		{
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == Capacity)
+				return false;
+			items[t & (Capacity - 1)] = item;
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+		bool tryPop(T &item)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+				return false;
+			item = items[h & (Capacity - 1)];
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+		size_t size() const
+		{
+			return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
 		}
 	};
 
-	class Handler2: public Base
+	//Concurrent mode: every handler of a chain runs on its own worker, and a request the handler does not
+	//own is forwarded to the successor's worker through a bounded ring instead of a direct call.
+	//A full ring makes the upstream stage (or the submitter) wait, which is the backpressure.
+	//A stage with nothing to do, or waiting on a full ring, spins briefly and then parks on an atomic wait, so
+	//idle stages of a long chain do not keep cores busy.
+	//Each handler's process() is only ever called from its own worker; the unhandled sink runs on the last one.
+	class PipelinedChain
 	{
 	  public:
-		void handle(int i)
+		struct StageStats
+		{
+			std::atomic<unsigned long> handled;
+			std::atomic<unsigned long> forwarded;
+			std::atomic<unsigned long> stalls;		// times the stage waited on a full successor ring
+			std::atomic<unsigned long> maxDepth;	// deepest inbound queue seen by the stage
+			std::atomic<unsigned long long> latencyNs;	// inbound queueing plus handling time, summed
+		};
+	  private:
+		struct Request
 		{
-			if (2 != i)
+			int key;
+			std::chrono::steady_clock::time_point enqueued;
+		};
+		enum { RING_SIZE = 1024, SPINS = 64 };
+		typedef SpscRing<Request, RING_SIZE> Ring;
+
+		struct Stage
+		{
+			Base *handler;
+			Ring inbound;
+			std::atomic<bool> upstreamDone;
+			std::atomic<int> consumerParked;	// the stage's worker sleeps until its ring has work
+			std::atomic<int> producerParked;	// whoever feeds the ring sleeps until it has room
+			StageStats stats;
+			std::thread worker;
+		};
+
+		std::vector<std::unique_ptr<Stage> > stages;
+		Base::Sink unhandled;
+		std::mutex submitting;	// the first stage's ring has one producer, so concurrent submitters take turns
+
+		// A sleeper sets its flag, fences, then rechecks its condition; a waker changes the condition, fences,
+		// then checks the flag. The two fences make sure one of them sees the other's write.
+		static void park(std::atomic<int> &parked, bool stillBlocked)
+		{
+			if (stillBlocked)
+				parked.wait(1, std::memory_order_relaxed);
+			parked.store(0, std::memory_order_relaxed);
+		}
+		static void wake(std::atomic<int> &parked)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (parked.load(std::memory_order_relaxed))
 			{
-				std::cout << "H2 passed " << i << "  ";
-				Base::handle(i);
+				parked.store(0, std::memory_order_relaxed);
+				parked.notify_one();
+			}
+		}
+
+		static void push(Stage &to, const Request &r, std::atomic<unsigned long> *stalls)
+		{
+			for (int spin = 0; !to.inbound.tryPush(r); spin++)
+			{
+				if (stalls)
+					stalls->fetch_add(1, std::memory_order_relaxed);
+				if (spin < SPINS)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				to.producerParked.store(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				park(to.producerParked, RING_SIZE == to.inbound.size());
+				spin = 0;
+			}
+			wake(to.consumerParked);
+		}
+
+		// Next request for the stage, or false once upstream is closed and the ring is drained.
+		static bool pop(Stage &st, Request &r)
+		{
+			for (int spin = 0; ; spin++)
+			{
+				if (st.inbound.tryPop(r))
+					break;
+				// Read the flag before the second pop so nothing pushed just before close is lost
+				bool closed = st.upstreamDone.load(std::memory_order_acquire);
+				if (st.inbound.tryPop(r))
+					break;
+				if (closed)
+					return false;
+				if (spin < SPINS)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+				st.consumerParked.store(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				park(st.consumerParked, 0 == st.inbound.size() && !st.upstreamDone.load(std::memory_order_relaxed));
+				spin = 0;
+			}
+			wake(st.producerParked);
+			return true;
+		}
+		static void closeInbound(Stage &st)
+		{
+			st.upstreamDone.store(true, std::memory_order_release);
+			wake(st.consumerParked);
+		}
+
+		void run(size_t s)
+		{
+			Stage &st = *stages[s];
+			Stage *succ = s + 1 < stages.size() ? stages[s + 1].get() : 0;
+			const int key = st.handler->key();
+			Request r;
+			for (;;)
+			{
+				unsigned long depth = st.inbound.size();
+				if (depth > st.stats.maxDepth.load(std::memory_order_relaxed))
+					st.stats.maxDepth.store(depth, std::memory_order_relaxed);
+				if (!pop(st, r))
+					break;
+				// A stage's latency ends when it has handled the request or hands it on, so stages do not add up
+				std::chrono::steady_clock::time_point finished;
+				if (r.key == key)
+				{
+					st.handler->process(r.key);
+					st.stats.handled.fetch_add(1, std::memory_order_relaxed);
+					finished = std::chrono::steady_clock::now();
+				}
+				else if (succ)
+				{
+					Request out = r;
+					out.enqueued = finished = std::chrono::steady_clock::now();
+					push(*succ, out, &st.stats.stalls);
+					st.stats.forwarded.fetch_add(1, std::memory_order_relaxed);
+				}
+				else
+				{
+					unhandled(r.key);
+					finished = std::chrono::steady_clock::now();
+				}
+				std::chrono::nanoseconds spent = finished - r.enqueued;
+				st.stats.latencyNs.fetch_add(spent.count(), std::memory_order_relaxed);
+			}
+			if (succ)
+				closeInbound(*succ);
+		}
+	  public:
+		PipelinedChain(Base *root, Base::Sink sink = &Base::defaultSink)
+		{
+			unhandled = sink;
+			std::vector<Base*> nodes;
+			if (root)
+				nodes = root->chain();
+			for (size_t h = 0; h < nodes.size(); h++)
+			{
+				stages.push_back(std::unique_ptr<Stage>(new Stage));
+				Stage &st = *stages.back();
+				st.handler = nodes[h];
+				st.upstreamDone = false;
+				st.consumerParked = 0;
+				st.producerParked = 0;
+				st.stats.handled = 0;
+				st.stats.forwarded = 0;
+				st.stats.stalls = 0;
+				st.stats.maxDepth = 0;
+				st.stats.latencyNs = 0;
+			}
+			for (size_t s = 0; s < stages.size(); s++)
+				stages[s]->worker = std::thread(&PipelinedChain::run, this, s);
+		}
+		~PipelinedChain()
+		{
+			close();
+		}
+		// Blocks while the first stage's ring is full. A chain without handlers sends everything to the sink.
+		// Safe to call from several threads; requests submitted by one thread keep their order.
+		void submit(int i)
+		{
+			if (stages.empty())
+			{
+				unhandled(i);
+				return;
+			}
+			Request r;
+			r.key = i;
+			std::lock_guard<std::mutex> lock(submitting);
+			r.enqueued = std::chrono::steady_clock::now();
+			push(*stages[0], r, 0);
+		}
+		// No more submissions, so it must not overlap submit(); waits until every stage has drained.
+		void close()
+		{
+			if (stages.empty() || !stages[0]->worker.joinable())
+				return;
+			closeInbound(*stages[0]);
+			for (size_t s = 0; s < stages.size(); s++)
+				stages[s]->worker.join();
+		}
+		size_t length() const
+		{
+			return stages.size();
+		}
+		const StageStats &stats(size_t s) const
+		{
+			return stages[s]->stats;
+		}
+		void report(std::ostream &os) const
+		{
+			for (size_t s = 0; s < stages.size(); s++)
+			{
+				const StageStats &st = stages[s]->stats;
+				unsigned long seen = st.handled + st.forwarded;
+				os << "stage " << s << ": handled " << st.handled << " forwarded " << st.forwarded
+					<< " stalls " << st.stalls << " max depth " << st.maxDepth
+					<< " avg latency " << (seen ? st.latencyNs / seen : 0) << " ns" << std::endl;
 			}
-			else
-			  std::cout << "H2 handled " << i << std::endl;
+		}
+	};
+
+	//Quiet handler used to build long chains
+	class KeyHandler: public Base
+	{
+		int k;
+	  public:
+		KeyHandler(int key = 0)
+		{
+			k = key;
+		}
+		int key() const
+		{
+			return k;
+		}
+		void process(int)
+		{
+		}
+		void processBatch(std::span<const int>)
+		{
+		}
+	};
+
+	//n quiet handlers with keys 0 .. n-1, wired into one chain rooted at the first
+	std::vector<KeyHandler> keyChain(int n)
+	{
+		std::vector<KeyHandler> chain;
+		chain.reserve(n);	// the handlers must not move once they are linked
+		for (int h = 0; h < n; h++)
+		{
+			chain.push_back(KeyHandler(h));
+			if (h)
+				chain[h - 1].setNext(&chain[h]);
+		}
+		return chain;
+	}
+
+	//Writes a whole slice of handled requests with one stream insertion and one flush
+	void printHandled(const char *name, std::span<const int> keys)
+	{
+		std::string out;
+		for (size_t k = 0; k < keys.size(); k++)
+		{
+			out += name;
+			out += " handled ";
+			out += std::to_string(keys[k]);
+			out += '\n';
+		}
+		std::cout << out << std::flush;
+	}
+
+	class Handler1: public Base
+	{
+	  public:
+		int key() const
+		{
+			return 1;
+		}
+		void process(int i)
+		{
+			std::cout << "H1 handled " << i << std::endl;
+		}
+		void processBatch(std::span<const int> keys)
+		{
+			printHandled("H1", keys);
+		}
+		void pass(int i)
+		{
+			std::cout << "H1 passed " << i << "  ";
+		}
+	};
+
+	class Handler2: public Base
+	{
+	  public:
+		int key() const
+		{
+			return 2;
+		}
+		void process(int i)
+		{
+			std::cout << "H2 handled " << i << std::endl;
+		}
+		void processBatch(std::span<const int> keys)
+		{
+			printHandled("H2", keys);
+		}
+		void pass(int i)
+		{
+			std::cout << "H2 passed " << i << "  ";
 		}
 	};
 
 	class Handler3: public Base
 	{
 	  public:
+		int key() const
+		{
+			return 3;
+		}
+		void process(int i)
+		{
+			std::cout << "H3 handled " << i << std::endl;
+		}
+		void processBatch(std::span<const int> keys)
+		{
+			printHandled("H3", keys);
+		}
+		void pass(int i)
+		{
+			std::cout << "H3 passed " << i << "  ";
+		}
+	};
+
+	//Adaptive mode: samples which handler accepts each request and every interval requests reorders runs of
+	//consecutive order-independent handlers, most frequent first or most recent first. The order lives in an
+	//immutable snapshot that is swapped atomically, so dispatching threads keep walking the order they loaded
+	//while a new one is published; the setNext wiring itself is left alone. process() may then be called from
+	//several threads at once.
+	//The handlers are watched like those of a compiled chain: a setNext() on any of them, or the destruction of
+	//one, makes the next handle() take the order from the wiring again. As with walk(), a handler is unlinked
+	//before it is destroyed (a destroyed root leaves the chain empty), and rewiring must not overlap handle().
+	class AdaptiveChain
+	{
+	  public:
+		enum Policy { FREQUENCY_SORTED, MOVE_TO_FRONT };
+	  private:
+		struct Entry
+		{
+			Base *handler;
+			int key;
+			size_t counter;	// index into the sample counters, fixed until the chain is rewired
+		};
+		struct Order
+		{
+			std::vector<Entry> entries;
+			std::shared_ptr<std::atomic<unsigned long>[]> samples;	// shared by every reordering of one wiring
+		};
+
+		Base *root;
+		CompiledChain wiring;	// only its watches are used: it goes stale when the chain is rewired
+		std::atomic<std::shared_ptr<const Order> > current;
+		std::atomic<size_t> lastAccepted;
+		std::atomic<unsigned long> requests;
+		std::atomic<unsigned long> hops;
+		std::mutex reordering;
+		Policy policy;
+		unsigned long interval;
+		Base::Sink unhandled;
+
+		// Takes the order from the setNext wiring, starting over with no samples. Called with reordering held.
+		void build()
+		{
+			if (root && !wiring.watches.empty() && !wiring.watches[0].node)
+				root = 0;	// the root itself has been destroyed
+			if (root)
+				wiring.compile(root);
+			else
+			{
+				wiring.unwatch();
+				wiring.order.clear();
+				wiring.stale = false;
+			}
+			std::shared_ptr<Order> order(new Order);
+			for (size_t h = 0; h < wiring.order.size(); h++)
+			{
+				Entry e = {wiring.order[h], wiring.order[h]->key(), h};
+				order->entries.push_back(e);
+			}
+			order->samples.reset(new std::atomic<unsigned long>[order->entries.size()]);
+			for (size_t c = 0; c < order->entries.size(); c++)
+				order->samples[c] = 0;
+			lastAccepted = 0;
+			current.store(order, std::memory_order_release);
+		}
+		void rewire()
+		{
+			std::lock_guard<std::mutex> lock(reordering);
+			if (wiring.stale)
+				build();
+		}
+	  public:
+		AdaptiveChain(Base *r, Policy p = FREQUENCY_SORTED, unsigned long reorderInterval = 4096)
+		{
+			root = r;
+			build();
+			requests = 0;
+			hops = 0;
+			policy = p;
+			interval = reorderInterval ? reorderInterval : 1;
+			unhandled = &Base::defaultSink;
+		}
+		void setUnhandled(Base::Sink s)
+		{
+			unhandled = s ? s : &Base::defaultSink;
+		}
 		void handle(int i)
 		{
-			if (3 != i)
+			if (wiring.stale.load(std::memory_order_relaxed))
+				rewire();
+			std::shared_ptr<const Order> order = current.load(std::memory_order_acquire);
+			const std::vector<Entry> &entries = order->entries;
+			size_t h = 0;
+			while (h < entries.size() && entries[h].key != i)
+				h++;
+			hops.fetch_add(h, std::memory_order_relaxed);
+			if (h < entries.size())
 			{
-				std::cout << "H3 passed " << i << "  ";
-				Base::handle(i);
+				const Entry &e = entries[h];
+				order->samples[e.counter].fetch_add(1, std::memory_order_relaxed);
+				lastAccepted.store(e.counter, std::memory_order_relaxed);
+				e.handler->process(i);
 			}
 			else
-			  std::cout << "H3 handled " << i << std::endl;
+				unhandled(i);
+			if (0 == (requests.fetch_add(1, std::memory_order_relaxed) + 1) % interval)
+				reorder();
+		}
+		// Publishes a new order; skipped when another thread is already reordering.
+		void reorder()
+		{
+			std::unique_lock<std::mutex> lock(reordering, std::try_to_lock);
+			if (!lock.owns_lock())
+				return;
+
+			std::shared_ptr<Order> next(new Order(*current.load(std::memory_order_acquire)));
+			std::vector<Entry> &entries = next->entries;
+			std::vector<unsigned long> weight(entries.size());
+			for (size_t c = 0; c < entries.size(); c++)
+				weight[c] = next->samples[c].load(std::memory_order_relaxed);
+			size_t recent = lastAccepted.load(std::memory_order_relaxed);
+
+			for (std::vector<Entry>::iterator run = entries.begin(); run != entries.end(); )
+			{
+				if (!run->handler->isOrderIndependent())
+				{
+					++run;
+					continue;
+				}
+				std::vector<Entry>::iterator end = run;
+				while (end != entries.end() && end->handler->isOrderIndependent())
+					++end;
+				if (FREQUENCY_SORTED == policy)
+				{
+					std::stable_sort(run, end, [&weight](const Entry &a, const Entry &b)
+						{ return weight[a.counter] > weight[b.counter]; });
+				}
+				else
+				{
+					std::vector<Entry>::iterator it = run;
+					while (it != end && it->counter != recent)
+						++it;
+					if (it != end)
+						std::rotate(run, it, it + 1);
+				}
+				run = end;
+			}
+			// Halve the samples so the order follows shifts in traffic
+			for (size_t c = 0; c < entries.size(); c++)
+				next->samples[c].store(weight[c] / 2, std::memory_order_relaxed);
+			current.store(next, std::memory_order_release);
+		}
+		// Average number of handlers skipped per request since the last reset.
+		double averageHops() const
+		{
+			unsigned long r = requests.load();
+			return r ? (double)hops.load() / r : 0.0;
+		}
+		void resetHops()
+		{
+			hops = 0;
+			requests = 0;
+		}
+	};
+
+	//Compile-time chain for when the handlers are known at build time: the handlers are held by value and
+	//the fold below calls key()/pass()/process() qualified by the concrete type, so there is no virtual call
+	//and no next pointer and the compiler can inline the whole decision sequence into handle().
+	template <typename... Handlers>
+	class Chain
+	{
+		std::tuple<Handlers...> handlers;
+		Base::Sink unhandled;
+
+		template <typename H>
+		static bool tryHandle(H &h, int i)
+		{
+			if (h.H::key() != i)
+			{
+				h.H::pass(i);
+				return false;
+			}
+			h.H::process(i);
+			return true;
+		}
+	  public:
+		Chain()
+		{
+			unhandled = &Base::defaultSink;
+		}
+		void setUnhandled(Base::Sink s)
+		{
+			unhandled = s ? s : &Base::defaultSink;
+		}
+		void handle(int i)
+		{
+			bool handled = std::apply([i](Handlers &... hs) { return (tryHandle(hs, i) || ...); }, handlers);
+			if (!handled)
+				unhandled(i);
+		}
+		template <size_t N>
+		typename std::tuple_element<N, std::tuple<Handlers...> >::type &get()
+		{
+			return std::get<N>(handlers);
 		}
 	};
 };
 
+namespace Bench
+{
+	unsigned long processed = 0;
+
+	template <int K>
+	class FixedHandler: public Demo1::Base
+	{
+	  public:
+		int key() const
+		{
+			return K;
+		}
+		void process(int)
+		{
+			++processed;
+		}
+		void processBatch(std::span<const int> keys)
+		{
+			processed += keys.size();
+		}
+	};
+
+	template <typename Seq>
+	struct FixedChain;
+
+	template <int... K>
+	struct FixedChain<std::integer_sequence<int, K...> >
+	{
+		typedef Demo1::Chain<FixedHandler<K>...> type;
+	};
+
+	//The same handler objects dispatched through the folded template chain and through the linked chain
+	template <int N>
+	void compileTimeChain(const std::vector<int> &requests)
+	{
+		typedef typename FixedChain<std::make_integer_sequence<int, N> >::type Static;
+		Static chain;
+		std::vector<Demo1::Base*> links;
+		[&]<size_t... I>(std::index_sequence<I...>) { (links.push_back(&chain.template get<I>()), ...); }
+			(std::make_index_sequence<N>());
+		for (int h = 1; h < N; h++)
+			links[h - 1]->setNext(links[h]);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < requests.size(); r++)
+			links[0]->walk(requests[r] % N);
+		double linked = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < requests.size(); r++)
+			chain.handle(requests[r] % N);
+		double folded = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "chain of " << N << " handlers: linked " << linked / requests.size() << " ns/request, compile-time "
+			<< folded / requests.size() << " ns/request" << std::endl;
+	}
+	//Cost per hop of the iterative walk should stay flat as the chain grows. A handler is one cache line, so once
+	//the chain outgrows the caches every hop also streams that line from memory.
+	void chainWalk()
+	{
+		const int lengths[] = {1000, 10000, 100000, 1000000};
+		for (int l = 0; l < 4; l++)
+		{
+			int n = lengths[l];
+			std::vector<Demo1::KeyHandler> chain = Demo1::keyChain(n);
+
+			int walks = 10000000 / n;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int w = 0; w < walks; w++)
+				chain[0].walk(n - 1);
+			double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			std::cout << "chain of " << n << " handlers (" << sizeof(Demo1::KeyHandler) * n / 1024 << " KB): "
+				<< ns / ((double)walks * n) << " ns/hop" << std::endl;
+		}
+	}
+
+	//A burst of requests dispatched one by one against the same burst dispatched as a batch
+	void batchDispatch()
+	{
+		const int n = 256;
+		std::vector<Demo1::KeyHandler> chain = Demo1::keyChain(n);
+		std::vector<int> burst(1 << 16);
+		for (size_t k = 0; k < burst.size(); k++)
+			burst[k] = std::rand() % n;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t k = 0; k < burst.size(); k++)
+			chain[0].walk(burst[k]);
+		double walked = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		chain[0].handle(std::span<const int>(burst));
+		double batched = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "burst of " << burst.size() << " on " << n << " handlers: walk " << walked / burst.size()
+			<< " ns/request, batch " << batched / burst.size() << " ns/request" << std::endl;
+	}
+
+	//Skewed traffic towards the tail of the chain through the fixed order and while the chain adapts, both on
+	//the calling thread; hops/request (handlers skipped) is the thread-independent measure of the reordering
+	void adaptive()
+	{
+		const int n = 64;
+		std::vector<Demo1::KeyHandler> chain = Demo1::keyChain(n);
+		for (int h = 0; h < n; h++)
+			chain[h].setOrderIndependent(true);
+		Demo1::AdaptiveChain adaptive(&chain[0]);
+
+		const int requests = 400000;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < requests; r++)
+			chain[0].walk(r % 8 ? n - 1 - r % 4 : r % n);
+		double fixed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		unsigned long fixedHops = 0;
+		for (int h = 0; h < n; h++)
+			fixedHops += chain[h].getPasses();
+
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < requests; r++)
+			adaptive.handle(r % 8 ? n - 1 - r % 4 : r % n);
+		double adapted = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << requests << " skewed requests on " << n << " handlers: fixed order " << fixed << " ms, "
+			<< (double)fixedHops / requests << " hops/request; adaptive " << adapted << " ms, "
+			<< adaptive.averageHops() << " hops/request" << std::endl;
+	}
+
+	void compileTimeChains()
+	{
+		std::vector<int> requests(1 << 18);
+		for (size_t r = 0; r < requests.size(); r++)
+			requests[r] = std::rand();
+		compileTimeChain<4>(requests);
+		compileTimeChain<16>(requests);
+		compileTimeChain<64>(requests);
+		std::cout << "(" << processed << " requests processed)" << std::endl;
+	}
+
+	//Throughput of the pipelined chain against the sequential walk on the same chain
+	void pipeline()
+	{
+		const int n = 8;
+		const int requests = 200000;
+		std::vector<Demo1::KeyHandler> chain = Demo1::keyChain(n);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < requests; r++)
+			chain[0].walk(r % n);
+		double walked = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		{
+			Demo1::PipelinedChain pipe(&chain[0]);
+			for (int r = 0; r < requests; r++)
+				pipe.submit(r % n);
+			pipe.close();
+		}
+		double piped = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << requests << " requests on " << n << " stages (" << std::thread::hardware_concurrency()
+			<< " cores): walk " << walked << " ms, pipelined " << piped << " ms" << std::endl;
+
+		//Processor time a long chain burns while no requests arrive, once its stages have parked
+		const int idle = 256;
+		std::vector<Demo1::KeyHandler> longChain = Demo1::keyChain(idle);
+		Demo1::PipelinedChain parked(&longChain[0]);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		std::clock_t cpu = std::clock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		std::cout << idle << " idle stages: " << (std::clock() - cpu) * 1000.0 / CLOCKS_PER_SEC
+			<< " ms processor time in 200 ms" << std::endl;
+		parked.close();
+	}
+};
+
 int main()
 {
 	{
@@ -138,7 +1210,75 @@ int main()
 		root.handle(1);
 		root.handle(2);
 		root.handle(3);
+
+		//Compile the chain once wiring is done, then handle() dispatches through the table
+		root.compile();
+		root.handle(1);
+		root.handle(2);
+		root.handle(3);
+		root.handle(4);
+
+		//Rewiring invalidates the table, the next handle() recompiles
+		root.setNext(&thr);
+		std::cout << "compiled after rewire: " << root.isCompiled() << std::endl;
+		root.handle(2);
+		root.handle(3);
+
+		//Requests nobody owns end up in the sink instead of dereferencing a null successor
+		root.walk(5);
+		std::cout << "H2 hits " << two.getHits() << " passes " << two.getPasses() << std::endl;
+
+		//A burst is partitioned by handler in one pass, each handler then takes its slice
+		root.setNext(&two);
+		std::vector<int> burst = {3, 1, 2, 3, 7, 1};
+		root.handle(std::span<const int>(burst));
+
+		//A chain linked back to its root compiles up to the link that closes the cycle
+		thr.setNext(&root);
+		root.handle(3);
+		root.handle(4);
+		std::cout << "cyclic chain of " << root.chain().size() << " handlers compiled: " << root.isCompiled() << std::endl;
+		thr.setNext(0);
+
+		//Concurrent mode: one worker per handler, rings in between
+		std::vector<Demo1::KeyHandler> quiet = Demo1::keyChain(4);
+		Demo1::PipelinedChain pipe(&quiet[0]);
+		for (int r = 0; r < 10000; r++)
+			pipe.submit(r % 4);
+		pipe.close();
+		pipe.report(std::cout);
+
+		//Adaptive mode: hot handlers at the tail move to the front of the order-independent run
+		for (int h = 0; h < 4; h++)
+			quiet[h].setOrderIndependent(true);
+		Demo1::AdaptiveChain adaptive(&quiet[0], Demo1::AdaptiveChain::FREQUENCY_SORTED, 100);
+		for (int r = 0; r < 1000; r++)
+			adaptive.handle(3);
+		std::cout << "adaptive hops/request while learning " << adaptive.averageHops();
+		adaptive.resetHops();
+		for (int r = 0; r < 1000; r++)
+			adaptive.handle(3);
+		std::cout << ", after " << adaptive.averageHops() << std::endl;
+
+		//Rewiring the chain under an adaptive order is picked up by the next request
+		quiet[2].setNext(0);
+		adaptive.handle(3);
+
+		//Handlers known at build time: folded into one function, no virtual calls
+		Demo1::Chain<Demo1::Handler1, Demo1::Handler2, Demo1::Handler3> fixed;
+		fixed.handle(1);
+		fixed.handle(3);
+		fixed.handle(4);
 		std::cout<<"End of Demo1"<<std::endl;
 	}
+	{
+		std::cout<<"Start of Bench1"<<std::endl;
+		Bench::chainWalk();
+		Bench::batchDispatch();
+		Bench::pipeline();
+		Bench::adaptive();
+		Bench::compileTimeChains();
+		std::cout<<"End of Bench1"<<std::endl;
+	}
 	return 0;
 }
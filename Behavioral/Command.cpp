@@ -50,17 +50,72 @@
 		(a).Command decouples the object that invokes the operation from the one that knows how to perform it.
 		(b).Commands are first-class objects.They can be manipulated and extended like any other object.
 		(c).You can assemble commands into a composite command.
+			-> CompiledMacro lowers such a sequence into an opcode array plus a receiver table and runs it with an
+				interpreter loop.
 		(e).It's easy to add new Commands, because you don't have to change existing classes.
 
 	Implementation(Things to be considered):
 		(a).How intelligent should a command be?
 		(b).Supporting undo and redo.
+			-> UndoHistory keeps a delta memento per command instead of a receiver copy, and spills old history to a
+				compressed ring with a byte budget.
 		(c).Avoiding error accumulation in the undo process.
 		(e).Using C++ templates.
+			-> InlineCommand is a value type that stores any callable bound to a Person receiver in a small inline
+				buffer, so short-lived commands need neither a heap allocation nor a Command subclass.
+		(f).Invoker as a subsystem.
+			-> The Invoker here is a work-stealing thread pool. Commands are serialised per receiver, so commands
+				bound to the same Person run in submission order while different receivers run in parallel.
+		(g).Queueing requests.
+			-> CoalescingQueue drops idempotent commands repeated back to back on a receiver and merges runs of
+				commuting commands into one batched receiver call, reporting how many executions it saved.
+		(h).Asynchronous execution.
+			-> executeAsync() is an awaitable form of execute(): a coroutine waiting on a slow receiver is parked
+				on a single-threaded AsyncScheduler instead of blocking a thread.
+		(i).Specify, queue, and execute requests at different times.
+			-> PriorityScheduler orders pending commands by class and deadline in a 4-ary heap, so latency critical
+				commands overtake bulk work, and tracks deadline misses and queueing delay per class.
+		(j).Logging changes so that they can be reapplied.
+			-> Journal appends the tag and receiver id of every executed command to a memory-mapped file, and
+				periodically snapshots the receivers and truncates itself so recovery stays bounded.
+
+	Build:
+		g++ -std=c++20 -O2 -pthread Command.cpp
 */
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <fstream>
+#include <system_error>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdint>
+#include <climits>
+#include <cstdio>
+#include <filesystem>
+#include <coroutine>
+#include <queue>
+#include <exception>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace Demo1
 {
@@ -68,96 +123,1776 @@ namespace Demo1
 	class Person
 	{
 		public:
+		// Id of a person no Directory has enrolled.
+		static const unsigned int NO_ID = UINT_MAX;
+		struct State
+		{
+			uint64_t said;
+			uint64_t passed;
+			uint64_t rumours;
+			uint64_t listening;
+		};
+
+		private:
+		State state;
+		unsigned int id;
+		std::chrono::microseconds responseTime;
+
+		public:
+		Person()
+		{
+			state.said = 0;
+			state.passed = 0;
+			state.rumours = 0;
+			state.listening = 0;
+			id = NO_ID;
+			responseTime = std::chrono::microseconds(0);
+		}
 		void talk()
 		{
 			std::cout << " Person is talking" << std::endl;
+			state.said++;
+			state.listening = 0;
 		}
 		void passOn()
 		{
 			std::cout << " Person is passing on" << std::endl;			
+			state.passed++;
 		}
 		void gossip()
 		{
 			std::cout << " Person is gossiping" << std::endl;
+			state.rumours++;
 		}
 		void listen()
 		{
 			std::cout << " Person is listening" << std::endl;
+			state.listening = 1;
+		}
+		// Passing on and gossiping only add up, so any number of them can be done in one go.
+		void batch(unsigned long passes, unsigned long rumours)
+		{
+			std::cout << " Person is passing on " << passes << " times and gossiping " << rumours << " times" << std::endl;
+			state.passed += passes;
+			state.rumours += rumours;
+		}
+		const State &getState() const
+		{
+			return state;
+		}
+		void setState(const State &s)
+		{
+			state = s;
+		}
+		unsigned int getId() const
+		{
+			return id;
+		}
+		void setId(unsigned int i)
+		{
+			id = i;
+		}
+		// How long the person takes to respond before an operation on it can be carried out.
+		std::chrono::microseconds getResponseTime() const
+		{
+			return responseTime;
+		}
+		void setResponseTime(std::chrono::microseconds t)
+		{
+			responseTime = t;
 		}
 	};
 
 	//Command
 	class Command
 	{
+		protected:
+		Person *_person;
+
 		public:
+		//Fixed tag of every concrete command, used where commands are stored as data
+		enum Tag { TALK, PASS_ON, GOSSIP, LISTEN };
+
+		Command(Person *person)
+		{
+			_person = person;
+		}
+		virtual ~Command()
+		{
+		}
 		virtual void execute() = 0;
+		virtual Tag tag() const = 0;
+		// Executing it twice in a row has the same effect as executing it once.
+		virtual bool isIdempotent() const
+		{
+			return false;
+		}
+		// Can be reordered with any other commuting command on the same receiver. Only PASS_ON and
+		// GOSSIP are merged by Person::batch(); commuting commands with other tags run one by one.
+		virtual bool commutes() const
+		{
+			return false;
+		}
+		Person *getReceiver() const
+		{
+			return _person;
+		}
 	};
 
 	//ConcreteCommand
 	class TalkCommand : public Command
 	{
-		Person *_person;
-
 		public:
-		TalkCommand(Person *person)
+		TalkCommand(Person *person) : Command(person)
 		{
-			_person = person;
 		}
 		void execute()
 		{
 			_person->talk();
 		}
+		Tag tag() const
+		{
+			return TALK;
+		}
 	};
 
 	//ConcreteCommand
 	class PassOnCommand : public Command
 	{
-		Person *_person;
-
 		public:
-		PassOnCommand(Person *person)
+		PassOnCommand(Person *person) : Command(person)
 		{
-			_person = person;
 		}
 		void execute()
 		{
 			_person->passOn();
 		}
+		Tag tag() const
+		{
+			return PASS_ON;
+		}
+		bool commutes() const
+		{
+			return true;
+		}
 	};
 
 	//ConcreteCommand
 	class GossipCommand : public Command
 	{
-		Person *_person;
-
 		public:
-		GossipCommand(Person *person)
+		GossipCommand(Person *person) : Command(person)
 		{
-			_person = person;
 		}
 		void execute()
 		{
 			_person->gossip();
 		}
+		Tag tag() const
+		{
+			return GOSSIP;
+		}
+		bool commutes() const
+		{
+			return true;
+		}
 	};
 
 	//ConcreteCommand
 	class ListenCommand : public Command
 	{
+		public:
+		ListenCommand(Person *person) : Command(person)
+		{
+		}
+		void execute()
+		{
+			_person->listen();
+		}
+		Tag tag() const
+		{
+			return LISTEN;
+		}
+		bool isIdempotent() const
+		{
+			return true;
+		}
+	};
+
+	//Value-semantic command: the callable is kept in an inline buffer and called through a per-type table of
+	//function pointers, so creating, moving and destroying one never touches the heap. The callable is invoked
+	//with the receiver, e.g. InlineCommand(person, &Person::talk) or InlineCommand(person, [](Person &p) {...}).
+	class InlineCommand
+	{
+		public:
+		enum { BUFFER_SIZE = 4 * sizeof(void*) };
+
+		private:
+		struct Ops
+		{
+			void (*invoke)(void *callable, Person *person);
+			void (*move)(void *to, void *from);
+			void (*destroy)(void *callable);
+		};
+
+		template <typename F>
+		struct OpsFor
+		{
+			static void invoke(void *callable, Person *person)
+			{
+				std::invoke(*static_cast<F*>(callable), *person);
+			}
+			static void move(void *to, void *from)
+			{
+				new (to) F(std::move(*static_cast<F*>(from)));
+				static_cast<F*>(from)->~F();
+			}
+			static void destroy(void *callable)
+			{
+				static_cast<F*>(callable)->~F();
+			}
+			static constexpr Ops table = {&invoke, &move, &destroy};
+		};
+
+		alignas(std::max_align_t) unsigned char storage[BUFFER_SIZE];
+		const Ops *ops;
 		Person *_person;
 
 		public:
-		ListenCommand(Person *person)
+		template <typename F, typename = typename std::enable_if<
+			!std::is_same<typename std::decay<F>::type, InlineCommand>::value>::type>
+		InlineCommand(Person *person, F &&f)
 		{
+			typedef typename std::decay<F>::type Callable;
+			static_assert(sizeof(Callable) <= BUFFER_SIZE, "callable does not fit the inline buffer");
+			static_assert(alignof(Callable) <= alignof(std::max_align_t), "callable is over-aligned");
+			static_assert(std::is_nothrow_move_constructible<Callable>::value, "callable must be nothrow movable");
+			new (storage) Callable(std::forward<F>(f));
+			ops = &OpsFor<Callable>::table;
 			_person = person;
 		}
+		InlineCommand(InlineCommand &&other) noexcept
+		{
+			ops = other.ops;
+			_person = other._person;
+			if (ops)
+				ops->move(storage, other.storage);
+			other.ops = 0;
+		}
+		InlineCommand &operator=(InlineCommand &&other) noexcept
+		{
+			if (this != &other)
+			{
+				if (ops)
+					ops->destroy(storage);
+				ops = other.ops;
+				_person = other._person;
+				if (ops)
+					ops->move(storage, other.storage);
+				other.ops = 0;
+			}
+			return *this;
+		}
+		InlineCommand(const InlineCommand &) = delete;
+		InlineCommand &operator=(const InlineCommand &) = delete;
+		~InlineCommand()
+		{
+			if (ops)
+				ops->destroy(storage);
+		}
 		void execute()
 		{
-			_person->listen();
+			ops->invoke(storage, _person);
+		}
+	};
+
+	//Invoker subsystem: a work-stealing pool that executes submitted commands.
+	//Commands are queued on a strand per receiver, and only the strand is ever scheduled: a strand sits in at most
+	//one worker deque at a time and is run by one worker at a time, so commands for the same Person keep their
+	//submission order while different receivers run in parallel. Workers take strands from the front of their
+	//own deque and steal from the back of the others. A strand found empty after a visit is removed, so the
+	//registry only holds receivers with pending commands. Submitted commands must outlive their completion.
+	class Invoker
+	{
+		struct Completion
+		{
+			std::atomic<size_t> remaining;
+			std::promise<void> done;
+		};
+		struct Task
+		{
+			Command *command;
+			std::shared_ptr<Completion> completion;
+		};
+		struct Strand
+		{
+			Person *receiver;
+			std::mutex lock;
+			std::deque<Task> tasks;
+			bool scheduled;
+		};
+		struct Worker
+		{
+			std::mutex lock;
+			std::deque<Strand*> strands;
+			std::thread thread;
+		};
+		enum { STRAND_BATCH = 64 };	// commands run per strand visit before it is requeued
+
+		std::vector<std::unique_ptr<Worker> > workers;
+		std::mutex strandsLock;
+		std::unordered_map<Person*, std::unique_ptr<Strand> > strands;
+		std::mutex sleepLock;
+		std::condition_variable wake;
+		std::atomic<size_t> ready;	// strands waiting in some deque
+		std::atomic<size_t> nextWorker;
+		bool stopping;
+
+		static thread_local const Invoker *currentInvoker;
+		static thread_local size_t currentWorker;
+
+		void schedule(Strand *strand)
+		{
+			size_t w = currentInvoker == this ? currentWorker
+				: nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+			{
+				std::lock_guard<std::mutex> guard(workers[w]->lock);
+				workers[w]->strands.push_back(strand);
+			}
+			ready.fetch_add(1);
+			std::lock_guard<std::mutex> guard(sleepLock);
+			wake.notify_one();
+		}
+
+		Strand *take(size_t self)
+		{
+			for (size_t k = 0; k < workers.size(); k++)
+			{
+				Worker &victim = *workers[(self + k) % workers.size()];
+				std::lock_guard<std::mutex> guard(victim.lock);
+				if (victim.strands.empty())
+					continue;
+				Strand *strand;
+				if (0 == k)
+				{
+					strand = victim.strands.front();
+					victim.strands.pop_front();
+				}
+				else
+				{
+					strand = victim.strands.back();
+					victim.strands.pop_back();
+				}
+				ready.fetch_sub(1);
+				return strand;
+			}
+			return 0;
+		}
+
+		void run(size_t self)
+		{
+			currentInvoker = this;
+			currentWorker = self;
+			std::vector<Task> batch;
+			for (;;)
+			{
+				Strand *strand = take(self);
+				if (!strand)
+				{
+					std::unique_lock<std::mutex> guard(sleepLock);
+					wake.wait(guard, [this]() { return ready.load() > 0 || stopping; });
+					if (stopping && 0 == ready.load())
+						return;
+					continue;
+				}
+
+				{
+					std::lock_guard<std::mutex> guard(strand->lock);
+					while (!strand->tasks.empty() && batch.size() < STRAND_BATCH)
+					{
+						batch.push_back(strand->tasks.front());
+						strand->tasks.pop_front();
+					}
+				}
+				for (size_t t = 0; t < batch.size(); t++)
+				{
+					batch[t].command->execute();
+					if (1 == batch[t].completion->remaining.fetch_sub(1))
+						batch[t].completion->done.set_value();
+				}
+				batch.clear();
+
+				bool more;
+				{
+					std::lock_guard<std::mutex> guard(strand->lock);
+					more = !strand->tasks.empty();
+				}
+				if (!more)
+					more = !retire(strand);
+				if (more)
+					schedule(strand);
+			}
+		}
+
+		// Removes a strand that is still empty once the registry is locked. The strand stays marked scheduled
+		// until then, so a concurrent submit only queues on it and the recheck here sees that command.
+		bool retire(Strand *strand)
+		{
+			std::unique_ptr<Strand> retired;
+			{
+				std::lock_guard<std::mutex> registry(strandsLock);
+				std::lock_guard<std::mutex> guard(strand->lock);
+				if (!strand->tasks.empty())
+					return false;
+				std::unordered_map<Person*, std::unique_ptr<Strand> >::iterator it = strands.find(strand->receiver);
+				retired = std::move(it->second);
+				strands.erase(it);
+			}
+			return true;
+		}
+
+		public:
+		Invoker(size_t threads = std::thread::hardware_concurrency())
+		{
+			ready = 0;
+			nextWorker = 0;
+			stopping = false;
+			if (0 == threads)
+				threads = 1;
+			for (size_t w = 0; w < threads; w++)
+				workers.push_back(std::unique_ptr<Worker>(new Worker));
+			for (size_t w = 0; w < threads; w++)
+				workers[w]->thread = std::thread(&Invoker::run, this, w);
+		}
+		// Finishes everything already submitted, then stops the workers.
+		~Invoker()
+		{
+			{
+				std::lock_guard<std::mutex> guard(sleepLock);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (size_t w = 0; w < workers.size(); w++)
+				workers[w]->thread.join();
+		}
+		std::future<void> submit(Command *command)
+		{
+			return submit(std::vector<Command*>(1, command));
+		}
+		// Queues a batch under one registry lock; the future is ready once every command of the batch has run.
+		std::future<void> submit(const std::vector<Command*> &batch)
+		{
+			std::shared_ptr<Completion> completion(new Completion);
+			completion->remaining = batch.size();
+			std::future<void> result = completion->done.get_future();
+			if (batch.empty())
+			{
+				completion->done.set_value();
+				return result;
+			}
+
+			std::vector<Strand*> wakeup;
+			{
+				std::lock_guard<std::mutex> guard(strandsLock);
+				for (size_t c = 0; c < batch.size(); c++)
+				{
+					std::unique_ptr<Strand> &slot = strands[batch[c]->getReceiver()];
+					if (!slot)
+					{
+						slot.reset(new Strand);
+						slot->receiver = batch[c]->getReceiver();
+						slot->scheduled = false;
+					}
+					Task task = {batch[c], completion};
+					std::lock_guard<std::mutex> strandGuard(slot->lock);
+					slot->tasks.push_back(task);
+					if (!slot->scheduled)
+					{
+						slot->scheduled = true;
+						wakeup.push_back(slot.get());
+					}
+				}
+			}
+			for (size_t s = 0; s < wakeup.size(); s++)
+				schedule(wakeup[s]);
+			return result;
+		}
+	};
+
+	thread_local const Invoker *Invoker::currentInvoker = 0;
+	thread_local size_t Invoker::currentWorker = 0;
+
+	//Queueing layer in front of Command::execute(). On flush, each receiver's commands are executed in the order
+	//they were queued (commands for different receivers are independent, so receivers are taken one after another):
+	//an idempotent command directly following one with the same tag is dropped, and a run of commuting commands is
+	//merged into a single batched call on the receiver. Queued commands must outlive the flush.
+	class CoalescingQueue
+	{
+		std::vector<Command*> pending;
+		unsigned long submitted;
+		unsigned long executed;
+
+		// The tags Person::batch() knows how to merge; anything else is never folded into a batch
+		static bool mergeable(const Command *command)
+		{
+			return command->commutes() && (Command::PASS_ON == command->tag() || Command::GOSSIP == command->tag());
+		}
+
+		public:
+		CoalescingQueue()
+		{
+			submitted = 0;
+			executed = 0;
+		}
+		void enqueue(Command *command)
+		{
+			pending.push_back(command);
+			submitted++;
+		}
+		void flush()
+		{
+			std::vector<Person*> receivers;
+			std::unordered_map<Person*, std::vector<Command*> > byReceiver;
+			for (size_t c = 0; c < pending.size(); c++)
+			{
+				std::vector<Command*> &queue = byReceiver[pending[c]->getReceiver()];
+				if (queue.empty())
+					receivers.push_back(pending[c]->getReceiver());
+				queue.push_back(pending[c]);
+			}
+			pending.clear();
+
+			for (size_t r = 0; r < receivers.size(); r++)
+			{
+				std::vector<Command*> &queue = byReceiver[receivers[r]];
+				Command *last = 0;
+				for (size_t c = 0; c < queue.size(); )
+				{
+					Command *command = queue[c];
+					if (command->isIdempotent() && last && last->tag() == command->tag())
+					{
+						c++;
+						continue;
+					}
+					size_t end = c + 1;
+					if (mergeable(command))
+						while (end < queue.size() && mergeable(queue[end]))
+							end++;
+					if (end - c > 1)
+					{
+						unsigned long passes = 0, rumours = 0;
+						for (size_t k = c; k < end; k++)
+						{
+							if (Command::PASS_ON == queue[k]->tag())
+								passes++;
+							else if (Command::GOSSIP == queue[k]->tag())
+								rumours++;
+						}
+						receivers[r]->batch(passes, rumours);
+					}
+					else
+						command->execute();
+					executed++;
+					last = queue[end - 1];
+					c = end;
+				}
+			}
+		}
+		size_t size() const
+		{
+			return pending.size();
+		}
+		// Executions avoided by coalescing and merging so far.
+		unsigned long saved() const
+		{
+			return submitted - pending.size() - executed;
+		}
+	};
+
+	//Coroutine returned by asynchronous command scripts. It starts suspended and is owned by the
+	//AsyncScheduler it is spawned on, which destroys its frame once it has run to completion.
+	struct AsyncTask
+	{
+		struct promise_type
+		{
+			AsyncTask get_return_object()
+			{
+				AsyncTask task;
+				task.handle = std::coroutine_handle<promise_type>::from_promise(*this);
+				return task;
+			}
+			std::suspend_always initial_suspend() noexcept
+			{
+				return std::suspend_always();
+			}
+			std::suspend_always final_suspend() noexcept
+			{
+				return std::suspend_always();
+			}
+			void return_void()
+			{
+			}
+			void unhandled_exception()
+			{
+				std::terminate();
+			}
+		};
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	//Single-threaded scheduler for coroutines waiting on slow receivers. A waiting command costs a timer entry
+	//and its coroutine frame rather than a blocked thread, so tens of thousands can be in flight at once.
+	class AsyncScheduler
+	{
+		typedef std::chrono::steady_clock Clock;
+		struct Timer
+		{
+			Clock::time_point due;
+			uint64_t seq;
+			std::coroutine_handle<> handle;
+			bool operator>(const Timer &other) const
+			{
+				return due != other.due ? due > other.due : seq > other.seq;
+			}
+		};
+
+		std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+		std::deque<std::coroutine_handle<> > runnable;
+		uint64_t seq;
+		size_t live;
+
+		void resume(std::coroutine_handle<> h)
+		{
+			h.resume();
+			if (h.done())
+			{
+				h.destroy();
+				live--;
+			}
+		}
+
+		public:
+		AsyncScheduler()
+		{
+			seq = 0;
+			live = 0;
+		}
+		~AsyncScheduler()
+		{
+			// Frames still suspended are only reachable from here
+			while (!timers.empty())
+			{
+				timers.top().handle.destroy();
+				timers.pop();
+			}
+			for (size_t r = 0; r < runnable.size(); r++)
+				runnable[r].destroy();
+		}
+		void spawn(AsyncTask task)
+		{
+			live++;
+			runnable.push_back(task.handle);
+		}
+		void resumeAt(Clock::time_point due, std::coroutine_handle<> h)
+		{
+			Timer t = {due, seq++, h};
+			timers.push(t);
+		}
+		// Runs until every spawned task has finished.
+		void run()
+		{
+			while (live)
+			{
+				while (!runnable.empty())
+				{
+					std::coroutine_handle<> h = runnable.front();
+					runnable.pop_front();
+					resume(h);
+				}
+				if (timers.empty())
+					break;
+				std::this_thread::sleep_until(timers.top().due);
+				Clock::time_point now = Clock::now();
+				while (!timers.empty() && timers.top().due <= now)
+				{
+					std::coroutine_handle<> h = timers.top().handle;
+					timers.pop();
+					resume(h);
+				}
+			}
+		}
+		size_t inFlight() const
+		{
+			return live;
+		}
+	};
+
+	//Awaitable form of Command::execute(): suspends the calling coroutine for the receiver's response time
+	//instead of blocking the thread, then executes the command.
+	class ExecuteAwaitable
+	{
+		Command &command;
+		AsyncScheduler &scheduler;
+
+		public:
+		ExecuteAwaitable(Command &c, AsyncScheduler &s) : command(c), scheduler(s)
+		{
+		}
+		bool await_ready() const
+		{
+			return command.getReceiver()->getResponseTime().count() <= 0;
+		}
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			scheduler.resumeAt(std::chrono::steady_clock::now() + command.getReceiver()->getResponseTime(), h);
+		}
+		void await_resume()
+		{
+			command.execute();
+		}
+	};
+
+	inline ExecuteAwaitable executeAsync(Command &command, AsyncScheduler &scheduler)
+	{
+		return ExecuteAwaitable(command, scheduler);
+	}
+
+	//Blocking counterpart: waits for the receiver on the calling thread
+	inline void executeBlocking(Command &command)
+	{
+		std::this_thread::sleep_for(command.getReceiver()->getResponseTime());
+		command.execute();
+	}
+
+	inline AsyncTask perform(AsyncScheduler &scheduler, std::vector<Command*> script)
+	{
+		for (size_t c = 0; c < script.size(); c++)
+			co_await executeAsync(*script[c], scheduler);
+	}
+
+	//Macro command lowered to a flat program: one opcode byte per step plus a parallel operand array that indexes a
+	//table of the receivers involved. Running it is a tight interpreter loop with no allocation and no indirect
+	//call through a Command per step. The commands it was compiled from are not needed afterwards.
+	class CompiledMacro
+	{
+		enum Opcode { OP_TALK, OP_PASS_ON, OP_GOSSIP, OP_LISTEN, OP_HALT };
+
+		std::vector<uint8_t> program;
+		std::vector<uint32_t> operands;
+		std::vector<Person*> receivers;
+
+		public:
+		static CompiledMacro compile(const std::vector<Command*> &sequence)
+		{
+			static const uint8_t lowered[] = {OP_TALK, OP_PASS_ON, OP_GOSSIP, OP_LISTEN};
+			CompiledMacro macro;
+			std::unordered_map<Person*, uint32_t> slot;
+			macro.program.reserve(sequence.size() + 1);
+			macro.operands.reserve(sequence.size() + 1);
+			for (size_t c = 0; c < sequence.size(); c++)
+			{
+				Person *person = sequence[c]->getReceiver();
+				std::unordered_map<Person*, uint32_t>::iterator it = slot.find(person);
+				if (slot.end() == it)
+				{
+					it = slot.insert(std::make_pair(person, (uint32_t)macro.receivers.size())).first;
+					macro.receivers.push_back(person);
+				}
+				macro.program.push_back(lowered[sequence[c]->tag()]);
+				macro.operands.push_back(it->second);
+			}
+			// The trailing halt lets the loop run without a bounds check
+			macro.program.push_back(OP_HALT);
+			macro.operands.push_back(0);
+			return macro;
+		}
+		void execute()
+		{
+			const uint8_t *pc = program.data();
+			const uint32_t *operand = operands.data();
+			Person *const *table = receivers.data();
+#if defined(__GNUC__)
+			static void *const dispatch[] = {&&talk, &&passOn, &&gossip, &&listen, &&halt};
+			goto *dispatch[*pc];
+		talk:
+			table[*operand++]->talk();
+			goto *dispatch[*++pc];
+		passOn:
+			table[*operand++]->passOn();
+			goto *dispatch[*++pc];
+		gossip:
+			table[*operand++]->gossip();
+			goto *dispatch[*++pc];
+		listen:
+			table[*operand++]->listen();
+			goto *dispatch[*++pc];
+		halt:
+			return;
+#else
+			for (;; ++pc, ++operand)
+			{
+				switch (*pc)
+				{
+					case OP_TALK: table[*operand]->talk(); break;
+					case OP_PASS_ON: table[*operand]->passOn(); break;
+					case OP_GOSSIP: table[*operand]->gossip(); break;
+					case OP_LISTEN: table[*operand]->listen(); break;
+					default: return;
+				}
+			}
+#endif
+		}
+		// Number of steps in the program.
+		size_t size() const
+		{
+			return program.size() - 1;
+		}
+	};
+
+	//Hands out the receiver ids used by journal records
+	class Directory
+	{
+		std::vector<Person*> people;
+
+		public:
+		unsigned int enrol(Person *person)
+		{
+			person->setId((unsigned int)people.size());
+			people.push_back(person);
+			return person->getId();
+		}
+		Person *at(unsigned int id) const
+		{
+			return id < people.size() ? people[id] : 0;
+		}
+		// False for a person never enrolled here, including one whose id was since handed out by another directory.
+		bool contains(const Person *person) const
+		{
+			return person && at(person->getId()) == person;
+		}
+		// Takes the person out; the id is not handed out again, so records kept under it resolve to no one.
+		void remove(Person *person)
+		{
+			if (!contains(person))
+				return;
+			people[person->getId()] = 0;
+			person->setId(Person::NO_ID);
+		}
+		size_t size() const
+		{
+			return people.size();
+		}
+	};
+
+	//Re-executes the operation a command tag stands for
+	inline void apply(Person &person, Command::Tag tag)
+	{
+		switch (tag)
+		{
+			case Command::TALK: person.talk(); break;
+			case Command::PASS_ON: person.passOn(); break;
+			case Command::GOSSIP: person.gossip(); break;
+			case Command::LISTEN: person.listen(); break;
+		}
+	}
+
+	//Binary write-ahead journal of commands kept in a preallocated, memory-mapped file. A record is the command tag
+	//and the receiver id, written straight into the mapping, so appending is a couple of stores.
+	//Once compactAfter records have accumulated the journal snapshots every enrolled receiver's state to
+	//<path>.snap and truncates itself, which keeps recovery bounded however long the process has been running.
+	//The header's epoch tells recovery whether the records on disk are already covered by the snapshot, so a
+	//crash between writing the snapshot and truncating never replays a command twice.
+	class Journal
+	{
+		struct Record
+		{
+			uint32_t receiver;
+			uint8_t tag;
+			uint8_t reserved[3];
+		};
+		struct Header
+		{
+			uint64_t magic;
+			uint64_t capacity;
+			uint64_t epoch;
+			std::atomic<uint64_t> count;	// records published; a record is written before the count moves past it
+		};
+		struct SnapshotHeader
+		{
+			uint64_t magic;
+			uint64_t epoch;
+			uint64_t people;
+		};
+		static const uint64_t MAGIC = 0x4c4e524a444d4321ULL;
+		static const uint64_t SNAPSHOT_MAGIC = 0x50534e53444d4321ULL;
+
+		std::string path;
+		Directory &directory;
+		int fd;
+		size_t bytes;
+		Header *header;
+		Record *records;
+		size_t compactAfter;
+
+		static void fail(const std::string &what)
+		{
+			throw std::system_error(errno, std::generic_category(), what);
+		}
+
+		bool loadSnapshot(uint64_t &epoch)
+		{
+			std::ifstream in((path + ".snap").c_str(), std::ios::binary);
+			SnapshotHeader sh;
+			if (!in.read(reinterpret_cast<char*>(&sh), sizeof(sh)) || SNAPSHOT_MAGIC != sh.magic)
+				return false;
+			for (uint64_t p = 0; p < sh.people; p++)
+			{
+				Person::State state;
+				if (!in.read(reinterpret_cast<char*>(&state), sizeof(state)))
+					return false;
+				if (Person *person = directory.at((unsigned int)p))
+					person->setState(state);
+			}
+			epoch = sh.epoch;
+			return true;
+		}
+
+		public:
+		// Opens the journal at file, or creates it. Throws std::system_error when the file cannot be mapped and
+		// std::runtime_error when an existing journal claims more records than its capacity.
+		Journal(const std::string &file, Directory &dir, size_t capacity = 1 << 20, size_t compactEvery = 0)
+			: path(file), directory(dir)
+		{
+			compactAfter = compactEvery && compactEvery <= capacity ? compactEvery : capacity;
+			bytes = sizeof(Header) + capacity * sizeof(Record);
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+			if (fd < 0)
+				fail("open " + path);
+			struct stat st;
+			if (::fstat(fd, &st) < 0)
+				fail("stat " + path);
+			if ((size_t)st.st_size < bytes && ::ftruncate(fd, bytes) < 0)
+				fail("preallocate " + path);
+			void *map = ::mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (MAP_FAILED == map)
+				fail("mmap " + path);
+			header = static_cast<Header*>(map);
+			records = reinterpret_cast<Record*>(header + 1);
+			if (MAGIC != header->magic || header->capacity != capacity)
+			{
+				header->capacity = capacity;
+				header->epoch = 0;
+				header->count.store(0);
+				header->magic = MAGIC;
+			}
+			else if (header->count.load() > capacity)
+			{
+				// Replaying this file would read past the mapping
+				::munmap(header, bytes);
+				::close(fd);
+				throw std::runtime_error("journal: " + path + " claims more records than it can hold");
+			}
+		}
+		~Journal()
+		{
+			::msync(header, bytes, MS_SYNC);
+			::munmap(header, bytes);
+			::close(fd);
+		}
+		Journal(const Journal &) = delete;
+		Journal &operator=(const Journal &) = delete;
+
+		// Records a command before it runs (write-ahead). A full journal compacts first, and since the command has
+		// not changed its receiver yet the snapshot does not contain it; it is then only replayed from its record.
+		// Throws std::invalid_argument when the receiver is not enrolled in the journal's directory, since its
+		// record would otherwise be replayed onto whoever holds that id.
+		void append(const Command &command)
+		{
+			if (!directory.contains(command.getReceiver()))
+				throw std::invalid_argument("journal: command receiver is not enrolled in the directory");
+			uint64_t n = header->count.load(std::memory_order_relaxed);
+			if (n >= compactAfter)
+			{
+				compact();
+				n = 0;
+			}
+			Record &r = records[n];
+			r.receiver = command.getReceiver()->getId();
+			r.tag = (uint8_t)command.tag();
+			header->count.store(n + 1, std::memory_order_release);
+		}
+		void execute(Command &command)
+		{
+			append(command);
+			command.execute();
+		}
+		// Snapshots the receivers and truncates the journal.
+		void compact()
+		{
+			std::string tmp = path + ".snap.tmp";
+			{
+				std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+				SnapshotHeader sh = {SNAPSHOT_MAGIC, header->epoch + 1, directory.size()};
+				out.write(reinterpret_cast<const char*>(&sh), sizeof(sh));
+				for (size_t p = 0; p < directory.size(); p++)
+				{
+					// An id whose person was removed keeps its slot so the ids after it still line up
+					Person::State state = {0, 0, 0, 0};
+					if (Person *person = directory.at((unsigned int)p))
+						state = person->getState();
+					out.write(reinterpret_cast<const char*>(&state), sizeof(state));
+				}
+				out.flush();
+				if (!out)
+					fail("write " + tmp);
+			}
+			if (::rename(tmp.c_str(), (path + ".snap").c_str()) < 0)
+				fail("rename " + tmp);
+			header->count.store(0, std::memory_order_release);
+			header->epoch++;
+		}
+		// Re-executes every record currently in the journal; records for ids the directory does not know, or with
+		// a tag no command has, are skipped. Returns the number of records applied.
+		size_t replay()
+		{
+			uint64_t n = header->count.load(std::memory_order_acquire);
+			size_t applied = 0;
+			for (uint64_t k = 0; k < n; k++)
+			{
+				Person *person = directory.at(records[k].receiver);
+				if (person && records[k].tag <= Command::LISTEN)
+				{
+					apply(*person, (Command::Tag)records[k].tag);
+					applied++;
+				}
+			}
+			return applied;
+		}
+		// Restores the receivers from the last snapshot, then replays what was journaled after it.
+		size_t recover()
+		{
+			uint64_t epoch = 0;
+			if (!loadSnapshot(epoch))
+				return replay();
+			if (epoch == header->epoch + 1)
+			{
+				// Crashed after the snapshot but before the truncate: the records are already in the snapshot
+				header->count.store(0, std::memory_order_release);
+				header->epoch = epoch;
+				return 0;
+			}
+			return replay();
+		}
+		void sync()
+		{
+			::msync(header, bytes, MS_SYNC);
+		}
+		size_t size() const
+		{
+			return header->count.load(std::memory_order_acquire);
+		}
+	};
+
+	//Undo/redo history. Each executed command leaves a delta memento (its tag, the receiver id and the one bit of
+	//receiver state it overwrites) rather than a copy of the receiver. The undo and the redo stack each keep their
+	//newest mementos plain and spill older ones in blocks to a compressed ring, about one byte per entry. Both rings
+	//share one byte budget, and a stack that spills past it drops its own oldest blocks, so memory stays bounded
+	//however long the history grows and however much of it is undone.
+	class UndoHistory
+	{
+		struct Memento
+		{
+			uint32_t receiver;
+			uint8_t tag;
+			uint8_t wasListening;
+		};
+		struct Block
+		{
+			std::vector<uint8_t> bytes;
+			size_t entries;
+		};
+		// One stack of mementos: the newest plain at the back of recent, older ones in ring blocks, oldest first.
+		struct Tier
+		{
+			std::deque<Memento> recent;
+			std::deque<Block> ring;
+			size_t ringBytes;
+			size_t ringEntries;
+
+			Tier()
+			{
+				ringBytes = 0;
+				ringEntries = 0;
+			}
+			size_t size() const
+			{
+				return recent.size() + ringEntries;
+			}
+			void clear()
+			{
+				recent.clear();
+				ring.clear();
+				ringBytes = 0;
+				ringEntries = 0;
+			}
+		};
+
+		Directory &directory;
+		Tier undoable;
+		Tier redoable;
+		size_t recentCapacity;
+		size_t ringBudget;
+		unsigned long dropped;
+
+		static void putVarint(std::vector<uint8_t> &out, uint32_t v)
+		{
+			while (v >= 0x80)
+			{
+				out.push_back((uint8_t)(v | 0x80));
+				v >>= 7;
+			}
+			out.push_back((uint8_t)v);
+		}
+		static uint32_t getVarint(const uint8_t *&in)
+		{
+			uint32_t v = 0;
+			for (int shift = 0; ; shift += 7)
+			{
+				uint8_t b = *in++;
+				v |= (uint32_t)(b & 0x7f) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+		}
+
+		// Entry byte: bits 0-1 tag, bit 2 the overwritten listening flag, bit 3 set when the receiver differs
+		// from the previous entry's, in which case the receiver id follows as a varint.
+		void spill(Tier &t)
+		{
+			size_t n = t.recent.size() / 2;
+			Block block;
+			block.entries = n;
+			uint32_t previous = 0;
+			for (size_t k = 0; k < n; k++)
+			{
+				const Memento &m = t.recent[k];
+				bool changed = 0 == k || m.receiver != previous;
+				block.bytes.push_back((uint8_t)(m.tag | m.wasListening << 2 | (changed ? 8 : 0)));
+				if (changed)
+					putVarint(block.bytes, m.receiver);
+				previous = m.receiver;
+			}
+			block.bytes.shrink_to_fit();
+			t.recent.erase(t.recent.begin(), t.recent.begin() + n);
+			t.ringBytes += block.bytes.size();
+			t.ringEntries += n;
+			t.ring.push_back(std::move(block));
+			while (undoable.ringBytes + redoable.ringBytes > ringBudget && !t.ring.empty())
+			{
+				t.ringBytes -= t.ring.front().bytes.size();
+				t.ringEntries -= t.ring.front().entries;
+				dropped += t.ring.front().entries;
+				t.ring.pop_front();
+			}
+		}
+		void unspill(Tier &t)
+		{
+			const Block &block = t.ring.back();
+			const uint8_t *in = block.bytes.data();
+			std::vector<Memento> decoded(block.entries);
+			uint32_t previous = 0;
+			for (size_t k = 0; k < block.entries; k++)
+			{
+				uint8_t head = *in++;
+				if (head & 8)
+					previous = getVarint(in);
+				decoded[k].receiver = previous;
+				decoded[k].tag = head & 3;
+				decoded[k].wasListening = (head >> 2) & 1;
+			}
+			t.recent.insert(t.recent.begin(), decoded.begin(), decoded.end());
+			t.ringBytes -= block.bytes.size();
+			t.ringEntries -= block.entries;
+			t.ring.pop_back();
+		}
+		void push(Tier &t, const Memento &m)
+		{
+			t.recent.push_back(m);
+			if (t.recent.size() > recentCapacity)
+				spill(t);
+		}
+		// Takes the newest memento whose receiver is still in the directory; the ones above it are forgotten.
+		Person *pop(Tier &t, Memento &m)
+		{
+			for (;;)
+			{
+				if (t.recent.empty() && !t.ring.empty())
+					unspill(t);
+				if (t.recent.empty())
+					return 0;
+				m = t.recent.back();
+				t.recent.pop_back();
+				if (Person *receiver = directory.at(m.receiver))
+					return receiver;
+				dropped++;
+			}
+		}
+		void record(Person &person, Command::Tag tag, uint64_t wasListening)
+		{
+			Memento m = {person.getId(), (uint8_t)tag, (uint8_t)(wasListening ? 1 : 0)};
+			push(undoable, m);
+		}
+
+		public:
+		UndoHistory(Directory &dir, size_t recentEntries = 4096, size_t ringBudgetBytes = 1 << 20) : directory(dir)
+		{
+			recentCapacity = recentEntries < 2 ? 2 : recentEntries;
+			ringBudget = ringBudgetBytes;
+			dropped = 0;
+		}
+		// Executes the command and remembers how to reverse it; anything undone before can no longer be redone.
+		// Throws std::invalid_argument, without executing, when the receiver is not enrolled in the directory.
+		void execute(Command &command)
+		{
+			if (!directory.contains(command.getReceiver()))
+				throw std::invalid_argument("undo history: command receiver is not enrolled in the directory");
+			Person &person = *command.getReceiver();
+			uint64_t wasListening = person.getState().listening;
+			command.execute();
+			record(person, command.tag(), wasListening);
+			redoable.clear();
+		}
+		// Reverses the newest entry. Entries for people removed from the directory since are forgotten and the
+		// newest one left is undone instead.
+		bool undo()
+		{
+			Memento m;
+			Person *receiver = pop(undoable, m);
+			if (!receiver)
+				return false;
+
+			Person &person = *receiver;
+			Person::State state = person.getState();
+			switch ((Command::Tag)m.tag)
+			{
+				case Command::TALK: state.said--; state.listening = m.wasListening; break;
+				case Command::PASS_ON: state.passed--; break;
+				case Command::GOSSIP: state.rumours--; break;
+				case Command::LISTEN: state.listening = m.wasListening; break;
+			}
+			person.setState(state);
+			push(redoable, m);
+			return true;
+		}
+		bool redo()
+		{
+			Memento m;
+			Person *receiver = pop(redoable, m);
+			if (!receiver)
+				return false;
+			Person &person = *receiver;
+			uint64_t wasListening = person.getState().listening;
+			apply(person, (Command::Tag)m.tag);
+			record(person, (Command::Tag)m.tag, wasListening);
+			return true;
+		}
+		// Entries that can still be undone.
+		size_t depth() const
+		{
+			return undoable.size();
+		}
+		// Entries that can still be redone.
+		size_t redoDepth() const
+		{
+			return redoable.size();
+		}
+		size_t memoryBytes() const
+		{
+			return (undoable.recent.size() + redoable.recent.size()) * sizeof(Memento)
+				+ undoable.ringBytes + redoable.ringBytes;
+		}
+		// Entries dropped to stay within the budget or because their receiver left the directory.
+		unsigned long forgotten() const
+		{
+			return dropped;
+		}
+	};
+
+	//Priority and deadline aware scheduling of commands. Pending commands sit in an implicit 4-ary min-heap
+	//ordered by priority class, then deadline, then submission order; four children share a cache line or two, so
+	//the heap is shallower and cheaper to sift than a binary one, and push/pop stay O(log n) at any depth.
+	//Each class counts executions, deadline misses and queueing delay.
+	class PriorityScheduler
+	{
+		public:
+		enum Class { CRITICAL, NORMAL, BULK, CLASSES };
+		typedef std::chrono::steady_clock Clock;
+
+		struct ClassStats
+		{
+			unsigned long executed;
+			unsigned long missed;
+			double totalDelayNs;
+			double maxDelayNs;
+		};
+
+		private:
+		struct Entry
+		{
+			int64_t deadline;	// ns since the clock's epoch
+			uint64_t order;		// class in the top bits, submission sequence below
+			int64_t enqueued;
+			Command *command;
+			bool operator<(const Entry &other) const
+			{
+				uint64_t cls = order >> 56, otherCls = other.order >> 56;
+				if (cls != otherCls)
+					return cls < otherCls;
+				if (deadline != other.deadline)
+					return deadline < other.deadline;
+				return order < other.order;
+			}
+		};
+		enum { ARITY = 4 };
+
+		std::vector<Entry> heap;
+		Class classOf[4];
+		ClassStats stats[CLASSES];
+		uint64_t seq;
+
+		static int64_t now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+		}
+		void siftUp(size_t i)
+		{
+			Entry e = heap[i];
+			while (i > 0)
+			{
+				size_t parent = (i - 1) / ARITY;
+				if (!(e < heap[parent]))
+					break;
+				heap[i] = heap[parent];
+				i = parent;
+			}
+			heap[i] = e;
+		}
+		void siftDown(size_t i)
+		{
+			Entry e = heap[i];
+			size_t n = heap.size();
+			for (;;)
+			{
+				size_t first = i * ARITY + 1;
+				if (first >= n)
+					break;
+				size_t best = first;
+				size_t last = std::min(first + ARITY, n);
+				for (size_t c = first + 1; c < last; c++)
+					if (heap[c] < heap[best])
+						best = c;
+				if (!(heap[best] < e))
+					break;
+				heap[i] = heap[best];
+				i = best;
+			}
+			heap[i] = e;
+		}
+
+		public:
+		PriorityScheduler()
+		{
+			// Talking is latency critical in our deployment, the rest is ordinary work
+			classOf[Command::TALK] = CRITICAL;
+			classOf[Command::PASS_ON] = NORMAL;
+			classOf[Command::GOSSIP] = NORMAL;
+			classOf[Command::LISTEN] = NORMAL;
+			for (int c = 0; c < CLASSES; c++)
+			{
+				stats[c].executed = 0;
+				stats[c].missed = 0;
+				stats[c].totalDelayNs = 0;
+				stats[c].maxDelayNs = 0;
+			}
+			seq = 0;
+		}
+		void setClass(Command::Tag tag, Class cls)
+		{
+			classOf[tag] = cls;
+		}
+		void reserve(size_t n)
+		{
+			heap.reserve(n);
+		}
+		// Queues a command that should run within the given time; the class defaults to the one of its tag.
+		void submit(Command *command, std::chrono::nanoseconds within)
+		{
+			submit(command, within, classOf[command->tag()]);
+		}
+		void submit(Command *command, std::chrono::nanoseconds within, Class cls)
+		{
+			int64_t t = now();
+			Entry e = {t + within.count(), (uint64_t)cls << 56 | seq++, t, command};
+			heap.push_back(e);
+			siftUp(heap.size() - 1);
+		}
+		// Executes the most urgent command; false when nothing is pending.
+		bool runOne()
+		{
+			if (heap.empty())
+				return false;
+			Entry e = heap[0];
+			heap[0] = heap.back();
+			heap.pop_back();
+			if (!heap.empty())
+				siftDown(0);
+
+			int64_t t = now();
+			ClassStats &st = stats[e.order >> 56];
+			double delay = (double)(t - e.enqueued);
+			st.executed++;
+			st.totalDelayNs += delay;
+			if (delay > st.maxDelayNs)
+				st.maxDelayNs = delay;
+			if (t > e.deadline)
+				st.missed++;
+			e.command->execute();
+			return true;
+		}
+		void runAll()
+		{
+			while (runOne())
+				;
+		}
+		size_t size() const
+		{
+			return heap.size();
+		}
+		const ClassStats &statistics(Class cls) const
+		{
+			return stats[cls];
+		}
+		void report(std::ostream &os) const
+		{
+			static const char *names[CLASSES] = {"critical", "normal", "bulk"};
+			for (int c = 0; c < CLASSES; c++)
+				os << names[c] << ": executed " << stats[c].executed << " missed " << stats[c].missed
+					<< " avg delay " << (stats[c].executed ? stats[c].totalDelayNs / stats[c].executed : 0)
+					<< " ns max " << stats[c].maxDelayNs << " ns" << std::endl;
 		}
 	};
 };
 
+namespace Bench
+{
+	//Silences std::cout while a benchmark runs so the receivers' printing does not dominate
+	class Mute
+	{
+		std::ios_base::iostate saved;
+		public:
+		Mute()
+		{
+			saved = std::cout.rdstate();
+			std::cout.setstate(std::ios_base::badbit);
+		}
+		~Mute()
+		{
+			std::cout.clear(saved);
+		}
+	};
+
+	//Creating, executing and destroying short-lived commands: new per command against InlineCommand
+	void inlineCommands()
+	{
+		const int count = 1000000;
+		Demo1::Person person;
+		double allocated, inlined;
+		{
+			Mute mute;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int c = 0; c < count; c++)
+			{
+				Demo1::Command *cmd;
+				if (c & 1)
+					cmd = new Demo1::TalkCommand(&person);
+				else
+					cmd = new Demo1::ListenCommand(&person);
+				cmd->execute();
+				delete cmd;
+			}
+			allocated = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			for (int c = 0; c < count; c++)
+			{
+				Demo1::InlineCommand cmd = (c & 1) ? Demo1::InlineCommand(&person, &Demo1::Person::talk)
+					: Demo1::InlineCommand(&person, &Demo1::Person::listen);
+				cmd.execute();
+			}
+			inlined = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout << count << " commands: new per command " << allocated / count << " ns/command, inline "
+			<< inlined / count << " ns/command" << std::endl;
+	}
+
+	//Commands spread over many receivers, executed inline and through the work-stealing Invoker
+	void invoker()
+	{
+		const int receivers = 64;
+		const int perReceiver = 4000;
+		std::vector<Demo1::Person> people(receivers);
+		std::vector<std::unique_ptr<Demo1::Command> > owned;
+		std::vector<Demo1::Command*> commands;
+		for (int c = 0; c < perReceiver; c++)
+			for (int r = 0; r < receivers; r++)
+			{
+				owned.push_back(std::unique_ptr<Demo1::Command>(new Demo1::GossipCommand(&people[r])));
+				commands.push_back(owned.back().get());
+			}
+
+		double inlined, pooled;
+		{
+			Mute mute;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t c = 0; c < commands.size(); c++)
+				commands[c]->execute();
+			inlined = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			Demo1::Invoker invoker;
+			start = std::chrono::steady_clock::now();
+			const size_t batch = 1024;
+			std::vector<std::future<void> > done;
+			for (size_t c = 0; c < commands.size(); c += batch)
+				done.push_back(invoker.submit(std::vector<Demo1::Command*>(commands.begin() + c,
+					commands.begin() + std::min(c + batch, commands.size()))));
+			for (size_t d = 0; d < done.size(); d++)
+				done[d].wait();
+			pooled = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout << commands.size() << " commands on " << receivers << " receivers: inline " << inlined
+			<< " ms, invoker (" << std::thread::hardware_concurrency() << " workers) " << pooled << " ms" << std::endl;
+	}
+
+	//Deep history: memory used per entry and the rate of undoing through spilled blocks
+	void undoHistory()
+	{
+		const int count = 4000000;
+		Demo1::Directory directory;
+		std::vector<Demo1::Person> people(4);
+		std::vector<std::unique_ptr<Demo1::Command> > commands;
+		for (size_t p = 0; p < people.size(); p++)
+		{
+			directory.enrol(&people[p]);
+			commands.push_back(std::unique_ptr<Demo1::Command>(new Demo1::TalkCommand(&people[p])));
+			commands.push_back(std::unique_ptr<Demo1::Command>(new Demo1::ListenCommand(&people[p])));
+		}
+
+		Demo1::UndoHistory history(directory, 4096, 1 << 21);
+		double undone;
+		size_t depth, bytes;
+		{
+			Mute mute;
+			for (int c = 0; c < count; c++)
+				history.execute(*commands[(c / 3) % commands.size()]);
+			depth = history.depth();
+			bytes = history.memoryBytes();
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			while (history.undo())
+				;
+			undone = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout << count << " commands: " << depth << " undoable in " << bytes << " bytes ("
+			<< (double)bytes / depth << " bytes/entry, " << history.forgotten() << " forgotten), undo "
+			<< undone / depth << " ns/entry; all undone: " << history.redoDepth() << " redoable in "
+			<< history.memoryBytes() << " bytes" << std::endl;
+	}
+
+	//Push and pop cost of the priority scheduler with a million commands pending, then deadline keeping when
+	//commands are run while others keep arriving
+	void priorityScheduler()
+	{
+		const int count = 1000000;
+		Demo1::Person person;
+		Demo1::TalkCommand talk(&person);
+		Demo1::GossipCommand gossip(&person);
+		Demo1::PriorityScheduler scheduler;
+		Demo1::PriorityScheduler live;
+		scheduler.reserve(count);
+		live.reserve(count);
+		double pushed, popped;
+		{
+			Mute mute;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int c = 0; c < count; c++)
+			{
+				if (c % 10)
+					scheduler.submit(&gossip, std::chrono::milliseconds(1 + std::rand() % 1000), Demo1::PriorityScheduler::BULK);
+				else
+					scheduler.submit(&talk, std::chrono::microseconds(std::rand() % 1000));
+			}
+			pushed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			scheduler.runAll();
+			popped = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			//The submissions above take far longer than a critical deadline, so deadlines are only meaningful
+			//when running keeps pace: one command is run after every second submission, so bulk work piles up behind
+			for (int c = 0; c < count; c++)
+			{
+				if (c % 10)
+					live.submit(&gossip, std::chrono::milliseconds(1 + std::rand() % 1000), Demo1::PriorityScheduler::BULK);
+				else
+					live.submit(&talk, std::chrono::microseconds(std::rand() % 1000));
+				if (c % 2)
+					live.runOne();
+			}
+			live.runAll();
+		}
+		std::cout << count << " pending commands: submit " << pushed / count << " ns, run " << popped / count
+			<< " ns" << std::endl;
+		std::cout << count << " commands run while arriving:" << std::endl;
+		live.report(std::cout);
+	}
+
+	//Commands waiting on slow receivers: the same commands as coroutines on one thread and with one thread per
+	//blocking command
+	void asyncCommands()
+	{
+		const std::chrono::microseconds response(20000);
+		const int count = 1000;
+		double suspended, blocked;
+		{
+			Mute mute;
+			std::vector<Demo1::Person> people(count);
+			std::vector<std::unique_ptr<Demo1::Command> > commands;
+			for (int c = 0; c < count; c++)
+			{
+				people[c].setResponseTime(response);
+				commands.push_back(std::unique_ptr<Demo1::Command>(new Demo1::TalkCommand(&people[c])));
+			}
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			Demo1::AsyncScheduler scheduler;
+			for (int c = 0; c < count; c++)
+				scheduler.spawn(Demo1::perform(scheduler, std::vector<Demo1::Command*>(1, commands[c].get())));
+			scheduler.run();
+			suspended = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			std::vector<std::thread> pool;
+			for (int t = 0; t < count; t++)
+				pool.push_back(std::thread(Demo1::executeBlocking, std::ref(*commands[t])));
+			for (int t = 0; t < count; t++)
+				pool[t].join();
+			blocked = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout << count << " commands, receiver response " << response.count() / 1000 << " ms: coroutines on one thread "
+			<< suspended << " ms (" << suspended * 1000 / count << " us/command), one blocking thread each " << blocked
+			<< " ms (" << blocked * 1000 / count << " us/command)" << std::endl;
+
+		//Far more waiting commands than threads could be started for, all suspended on the one scheduler at once
+		const int many = 50000;
+		size_t inFlight;
+		{
+			Mute mute;
+			std::vector<Demo1::Person> people(many);
+			std::vector<std::unique_ptr<Demo1::Command> > commands;
+			for (int c = 0; c < many; c++)
+			{
+				people[c].setResponseTime(response);
+				commands.push_back(std::unique_ptr<Demo1::Command>(new Demo1::TalkCommand(&people[c])));
+			}
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			Demo1::AsyncScheduler scheduler;
+			for (int c = 0; c < many; c++)
+				scheduler.spawn(Demo1::perform(scheduler, std::vector<Demo1::Command*>(1, commands[c].get())));
+			inFlight = scheduler.inFlight();
+			scheduler.run();
+			suspended = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout << inFlight << " commands in flight on one thread, receiver response " << response.count() / 1000
+			<< " ms: all done in " << suspended << " ms" << std::endl;
+	}
+
+	//A long scripted sequence run through Command objects and as a compiled macro
+	void compiledMacro()
+	{
+		const int steps = 1000000;
+		std::vector<Demo1::Person> people(8);
+		std::vector<std::unique_ptr<Demo1::Command> > owned;
+		std::vector<Demo1::Command*> script;
+		for (int c = 0; c < steps; c++)
+		{
+			Demo1::Person *p = &people[c % people.size()];
+			switch (c % 4)
+			{
+				case 0: owned.push_back(std::unique_ptr<Demo1::Command>(new Demo1::TalkCommand(p))); break;
+				case 1: owned.push_back(std::unique_ptr<Demo1::Command>(new Demo1::PassOnCommand(p))); break;
+				case 2: owned.push_back(std::unique_ptr<Demo1::Command>(new Demo1::GossipCommand(p))); break;
+				default: owned.push_back(std::unique_ptr<Demo1::Command>(new Demo1::ListenCommand(p))); break;
+			}
+			script.push_back(owned.back().get());
+		}
+		Demo1::CompiledMacro macro = Demo1::CompiledMacro::compile(script);
+
+		double objects, compiled;
+		{
+			Mute mute;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t c = 0; c < script.size(); c++)
+				script[c]->execute();
+			objects = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			macro.execute();
+			compiled = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout << steps << " scripted steps: command objects " << objects / steps << " ns/step, compiled macro "
+			<< compiled / steps << " ns/step" << std::endl;
+	}
+
+	//Cost of journaling a command, of replaying the journal, and of recovering after many compactions
+	void journal()
+	{
+		const int count = 1000000;
+		std::string path = (std::filesystem::temp_directory_path() / "command-bench.journal").string();
+		Demo1::Directory directory;
+		std::vector<Demo1::Person> people(16);
+		for (size_t p = 0; p < people.size(); p++)
+			directory.enrol(&people[p]);
+		std::vector<std::unique_ptr<Demo1::Command> > commands;
+		for (size_t p = 0; p < people.size(); p++)
+			commands.push_back(std::unique_ptr<Demo1::Command>(new Demo1::GossipCommand(&people[p])));
+
+		double appended, replayed, recovered;
+		size_t replayedCount, recoveredCount;
+		{
+			Mute mute;
+			Demo1::Journal journal(path, directory, 1 << 20, 1 << 16);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int c = 0; c < count; c++)
+				journal.append(*commands[c % commands.size()]);
+			appended = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			replayedCount = journal.replay();
+			replayed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			recoveredCount = journal.recover();
+			recovered = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::remove(path.c_str());
+		std::remove((path + ".snap").c_str());
+		std::cout << count << " journaled commands: append " << appended / count << " ns/command, replay "
+			<< replayed / replayedCount << " ns/command, recovery of " << recoveredCount << " records " << recovered
+			<< " ms" << std::endl;
+	}
+};
+
 int main()
 {
 	{
@@ -182,8 +1917,124 @@ int main()
 		listen->execute();
 		//Invoker end
 
+		//Heap-free commands are plain values that can be moved into containers
+		std::vector<Demo1::InlineCommand> script;
+		script.push_back(Demo1::InlineCommand(receiver, &Demo1::Person::talk));
+		script.push_back(Demo1::InlineCommand(receiver, [](Demo1::Person &p) { p.gossip(); p.passOn(); }));
+		for (size_t c = 0; c < script.size(); c++)
+			script[c].execute();
+
+		//The invoker runs commands on a pool; the same receiver sees them in submission order
+		{
+			Demo1::Invoker invoker;
+			std::vector<Demo1::Command*> batch = {talk, passon, gossip, listen};
+			invoker.submit(batch).wait();
+		}
+
+		//Executed commands go to a memory-mapped journal; recovery restores a fresh receiver from it
+		{
+			std::string path = (std::filesystem::temp_directory_path() / "command-demo.journal").string();
+			Demo1::Directory directory;
+			directory.enrol(receiver);
+			{
+				Demo1::Journal journal(path, directory, 1024, 3);
+				journal.execute(*talk);
+				journal.execute(*gossip);
+				journal.execute(*gossip);
+				journal.execute(*gossip);
+			}
+			Demo1::Person restored;
+			Demo1::Directory after;
+			after.enrol(&restored);
+			Demo1::Journal journal(path, after, 1024, 3);
+			std::cout << "Recovering from journal" << std::endl;
+			journal.recover();
+			std::cout << "Restored rumours " << restored.getState().rumours << " (expected "
+				<< receiver->getState().rumours << ")" << std::endl;
+			std::remove(path.c_str());
+			std::remove((path + ".snap").c_str());
+		}
+
+		//Redundant and commuting commands are coalesced before they reach the receiver
+		{
+			Demo1::CoalescingQueue queue;
+			queue.enqueue(listen);
+			queue.enqueue(listen);
+			queue.enqueue(listen);
+			queue.enqueue(gossip);
+			queue.enqueue(passon);
+			queue.enqueue(gossip);
+			queue.enqueue(talk);
+			queue.flush();
+			std::cout << "Executions saved " << queue.saved() << std::endl;
+		}
+
+		//A slow receiver: the coroutine suspends on the scheduler instead of blocking the thread
+		{
+			Demo1::Person slow;
+			slow.setResponseTime(std::chrono::milliseconds(10));
+			Demo1::TalkCommand slowTalk(&slow);
+			Demo1::ListenCommand slowListen(&slow);
+			Demo1::AsyncScheduler scheduler;
+			scheduler.spawn(Demo1::perform(scheduler, {&slowTalk, &slowListen}));
+			scheduler.spawn(Demo1::perform(scheduler, {gossip}));
+			scheduler.run();
+		}
+
+		//A command sequence compiled into a flat program and replayed
+		{
+			Demo1::CompiledMacro macro = Demo1::CompiledMacro::compile({talk, gossip, passon, listen});
+			macro.execute();
+		}
+
+		//Undo and redo through delta mementos
+		{
+			Demo1::Directory directory;
+			directory.enrol(receiver);
+			Demo1::UndoHistory history(directory);
+			uint64_t said = receiver->getState().said;
+			history.execute(*listen);
+			history.execute(*talk);
+			history.undo();
+			std::cout << "After undo: listening " << receiver->getState().listening << ", said "
+				<< receiver->getState().said - said << std::endl;
+			history.redo();
+			std::cout << "After redo: listening " << receiver->getState().listening << ", said "
+				<< receiver->getState().said - said << std::endl;
+
+			//History of someone who has left the directory is skipped
+			Demo1::Person visitor;
+			Demo1::GossipCommand visitorGossip(&visitor);
+			directory.enrol(&visitor);
+			history.execute(visitorGossip);
+			directory.remove(&visitor);
+			history.undo();
+			std::cout << "After undo past a removed person: said " << receiver->getState().said - said
+				<< ", forgotten " << history.forgotten() << std::endl;
+		}
+
+		//Talking jumps ahead of the bulk work queued before it
+		{
+			Demo1::PriorityScheduler scheduler;
+			scheduler.submit(gossip, std::chrono::seconds(1), Demo1::PriorityScheduler::BULK);
+			scheduler.submit(listen, std::chrono::milliseconds(100));
+			scheduler.submit(talk, std::chrono::milliseconds(1));
+			scheduler.runAll();
+		}
+
 		std::cout<<"End of Demo1"<<std::endl;
 	}
+	{
+		std::cout<<"Start of Bench1"<<std::endl;
+		Bench::inlineCommands();
+		Bench::invoker();
+		Bench::compiledMacro();
+		Bench::journal();
+		Bench::asyncCommands();
+		Bench::undoHistory();
+		Bench::priorityScheduler();
+		std::cout<<"End of Bench1"<<std::endl;
+	}
 	return 0;
 }
 
@@ -45,81 +45,871 @@
 		(b).Iterators implementation using freind.
 		(c).Iterators implementation using subclassing of aggregate and exposing the underlying methods
 			of aggregate using protected to Iterator.
+		(d).Stack keeps its items in one growable contiguous block, so operator== compares the lengths and then
+			the raw blocks with the widest vector compare the CPU supports (picked once at run time).
+		(e).StackIter is a trivially copyable value returned by createIterator(), so a traversal costs no allocation.
+			Besides first()/next()/isDone()/currentItem() it is a standard contiguous iterator, so range-for and the
+			std:: algorithms, including the parallel ones, run on a Stack directly.
+		(f).Stacks shared between threads use ConcurrentStack: a lock-free Treiber stack whose nodes are reclaimed
+			by epochs (which also rules out ABA on the head) and which pairs off colliding pushes and pops in an
+			elimination array.
+		(g).Copies of a Stack share their storage, so copying is O(1); a copy only gets a buffer of its own when it
+			pushes where another copy already has, e.g. a push after a pop, and that one push costs a full copy.
+		(h).Each Stack keeps a fingerprint of its contents, updated in O(1) by push and pop, so operator== rejects
+			stacks of equal length but different contents without reading their items.
+		(i).StackIter can split its remaining range in halves, spliterator style. ParallelTraversal uses that to run
+			reductions, searches and comparisons of large stacks on a thread pool, and falls back to the sequential
+			first/next/isDone loop below a tunable cutoff.
+
+	Build:
+		g++ -std=c++20 -O2 -pthread Iterator.cpp -ltbb	(TBB is libstdc++'s backend for the parallel algorithms)
 
 */
 
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <iterator>
+#include <compare>
+#include <type_traits>
+#include <algorithm>
+#include <numeric>
+#include <execution>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <latch>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace Demo1
 {
+	//Block compare of two int arrays, vectorized where the CPU allows it
+	namespace Simd
+	{
+		inline bool equalScalar(const int *a, const int *b, size_t n)
+		{
+			return 0 == n || 0 == std::memcmp(a, b, n * sizeof(int));
+		}
+
+#if defined(__x86_64__) || defined(__i386__)
+		__attribute__((target("sse2")))
+		inline bool equalSSE2(const int *a, const int *b, size_t n)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				__m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+				__m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 4)), _mm_loadu_si128((const __m128i*)(b + i + 4)));
+				__m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 8)), _mm_loadu_si128((const __m128i*)(b + i + 8)));
+				__m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 12)), _mm_loadu_si128((const __m128i*)(b + i + 12)));
+				__m128i d = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+				if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi32(d, _mm_setzero_si128())))
+					return false;
+			}
+			return equalScalar(a + i, b + i, n - i);
+		}
+
+		__attribute__((target("avx2")))
+		inline bool equalAVX2(const int *a, const int *b, size_t n)
+		{
+			size_t i = 0;
+			for (; i + 32 <= n; i += 32)
+			{
+				__m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+				__m256i d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 8)), _mm256_loadu_si256((const __m256i*)(b + i + 8)));
+				__m256i d2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 16)), _mm256_loadu_si256((const __m256i*)(b + i + 16)));
+				__m256i d3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 24)), _mm256_loadu_si256((const __m256i*)(b + i + 24)));
+				__m256i d = _mm256_or_si256(_mm256_or_si256(d0, d1), _mm256_or_si256(d2, d3));
+				if (!_mm256_testz_si256(d, d))
+					return false;
+			}
+			return equalSSE2(a + i, b + i, n - i);
+		}
+#endif
+
+		typedef bool (*EqualFn)(const int *, const int *, size_t);
+
+		inline EqualFn select()
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return &equalAVX2;
+			if (__builtin_cpu_supports("sse2"))
+				return &equalSSE2;
+#endif
+			return &equalScalar;
+		}
+
+		inline bool equal(const int *a, const int *b, size_t n)
+		{
+			static const EqualFn impl = select();
+			return a == b || impl(a, b, n);
+		}
+	};
+
 	class StackIter;
 
+	//Stack storage is persistent: copies share one append-only buffer, and each stack only owns the first count
+	//items of it. A slot past the end is claimed with a CAS on the buffer's high-water mark, so the first copy to
+	//push after a fork extends the shared buffer in place and any other copy that pushes moves to a buffer of its
+	//own. Items below a stack's count are never written again, which is why copies are O(1) and push/pop on one
+	//copy never disturb the others.
+	//A copy that pops and then pushes finds its next slot already claimed, so that push is copy-on-write: it pays
+	//O(count) once to move the copy to its own buffer, and the pushes and pops after it are O(1) again.
 	class Stack
 	{
-		int items[10];
-		int sp;
+		struct Buffer
+		{
+			std::atomic<size_t> used;	// slots claimed by any of the sharing stacks
+			size_t capacity;
+			std::unique_ptr<int[]> items;
+		};
+
+		std::shared_ptr<Buffer> buffer;
+		size_t count;
+		uint64_t fingerprint;	// sum of mix(item, position) over the items, kept up to date by push and pop
+
+		// Position-dependent hash of one item (splitmix64 finaliser)
+		static uint64_t mix(int item, size_t position)
+		{
+			uint64_t z = (uint64_t)(uint32_t)item ^ (position * 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			return z ^ (z >> 31);
+		}
+
+		void moveToOwnBuffer(size_t capacity)
+		{
+			std::shared_ptr<Buffer> grown(new Buffer);
+			grown->capacity = capacity;
+			grown->items.reset(new int[capacity]);
+			if (count && buffer)
+				std::memcpy(grown->items.get(), buffer->items.get(), count * sizeof(int));
+			grown->used = count;
+			buffer = grown;
+		}
 		public:
 		friend class StackIter;
 		Stack()
 		{
-			sp =  - 1;
+			count = 0;
+			fingerprint = 0;
+		}
+		Stack(const Stack &) = default;
+		Stack &operator=(const Stack &) = default;
+		// A moved-from stack is empty, not a count with no buffer behind it
+		Stack(Stack &&other) noexcept
+			: buffer(std::move(other.buffer)), count(other.count), fingerprint(other.fingerprint)
+		{
+			other.count = 0;
+			other.fingerprint = 0;
+		}
+		Stack &operator=(Stack &&other) noexcept
+		{
+			if (this != &other)
+			{
+				buffer = std::move(other.buffer);
+				count = other.count;
+				fingerprint = other.fingerprint;
+				other.count = 0;
+				other.fingerprint = 0;
+			}
+			return *this;
 		}
 		void push(int in)
 		{
-			items[++sp] = in;
+			size_t expected = count;
+			if (!buffer || count == buffer->capacity || !buffer->used.compare_exchange_strong(expected, count + 1))
+			{
+				moveToOwnBuffer(count < 8 ? 16 : count * 2);
+				buffer->used = count + 1;
+			}
+			fingerprint += mix(in, count);
+			buffer->items[count++] = in;
 		}
 		int pop()
 		{
-			return items[sp--];
+			if (0 == count)
+				throw std::out_of_range("pop on empty Stack");
+			int top = buffer->items[--count];
+			fingerprint -= mix(top, count);
+			// Only a sole owner may hand the slot back; a copy could still be reading it
+			if (1 == buffer.use_count())
+				buffer->used = count;
+			return top;
 		}
 		bool isEmpty()
 		{
-			return (sp ==  - 1);
+			return 0 == count;
+		}
+		size_t size() const
+		{
+			return count;
 		}
-		StackIter *createIterator() const; // 2. Add a createIterator() member
+		const int *data() const
+		{
+			return buffer ? buffer->items.get() : 0;
+		}
+		// Equal stacks always have equal fingerprints; different ones almost never do.
+		uint64_t getFingerprint() const
+		{
+			return fingerprint;
+		}
+		// Both stacks are views of the same buffer, so the shorter one is a prefix of the longer.
+		bool sharesStorageWith(const Stack &other) const
+		{
+			return buffer && buffer == other.buffer;
+		}
+		StackIter createIterator() const; // 2. Add a createIterator() member
+		StackIter begin() const;
+		StackIter end() const;
 	};
 
 	class StackIter
 	{
 		// 1. Design an "iterator" class
-		const Stack *stk;
-		int index;
+		const int *items;
+		std::ptrdiff_t start;	// the range this iterator traverses is [start, count)
+		std::ptrdiff_t index;
+		std::ptrdiff_t count;
 		public:
-		StackIter(const Stack *s)
+		typedef std::contiguous_iterator_tag iterator_concept;
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef int value_type;
+		typedef const int element_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const int *pointer;
+		typedef const int &reference;
+
+		StackIter() = default;
+		StackIter(const int *base, std::ptrdiff_t n, std::ptrdiff_t at)
 		{
-			stk = s;
+			items = base;
+			start = 0;
+			count = n;
+			index = at;
 		}
 		void first()
 		{
-			index = 0;
+			index = start;
 		}
 		void next()
 		{
 			index++;
 		}
-		bool isDone()
+		bool isDone() const
+		{
+			return index == count;
+		}
+		int currentItem() const
+		{
+			return items[index];
+		}
+		std::ptrdiff_t remaining() const
+		{
+			return count - index;
+		}
+		// Spliterator style: hands the first half of what is left to prefix and keeps the second half.
+		// Fails when fewer than two items are left.
+		bool trySplit(StackIter &prefix)
+		{
+			std::ptrdiff_t half = remaining() / 2;
+			if (half < 1)
+				return false;
+			prefix = *this;
+			prefix.start = index;
+			prefix.count = index + half;
+			start = index = index + half;
+			return true;
+		}
+
+		reference operator*() const
+		{
+			return items[index];
+		}
+		pointer operator->() const
+		{
+			return items + index;
+		}
+		reference operator[](difference_type n) const
+		{
+			return items[index + n];
+		}
+		StackIter &operator++()
+		{
+			++index;
+			return *this;
+		}
+		StackIter operator++(int)
+		{
+			StackIter old = *this;
+			++index;
+			return old;
+		}
+		StackIter &operator--()
+		{
+			--index;
+			return *this;
+		}
+		StackIter operator--(int)
+		{
+			StackIter old = *this;
+			--index;
+			return old;
+		}
+		StackIter &operator+=(difference_type n)
+		{
+			index += n;
+			return *this;
+		}
+		StackIter &operator-=(difference_type n)
+		{
+			index -= n;
+			return *this;
+		}
+		friend StackIter operator+(StackIter it, difference_type n)
 		{
-			return index == stk->sp + 1;
+			return it += n;
 		}
-		int currentItem()
+		friend StackIter operator+(difference_type n, StackIter it)
 		{
-			return stk->items[index];
+			return it += n;
 		}
+		friend StackIter operator-(StackIter it, difference_type n)
+		{
+			return it -= n;
+		}
+		friend difference_type operator-(const StackIter &l, const StackIter &r)
+		{
+			return l.index - r.index;
+		}
+		friend bool operator==(const StackIter &l, const StackIter &r)
+		{
+			return l.index == r.index;
+		}
+		friend std::strong_ordering operator<=>(const StackIter &l, const StackIter &r)
+		{
+			return l.index <=> r.index;
+		}
+	};
+
+	static_assert(std::is_trivially_copyable<StackIter>::value, "StackIter must stay a plain value");
+	static_assert(std::contiguous_iterator<StackIter>, "StackIter must model a contiguous iterator");
+
+	StackIter Stack::createIterator()const
+	{
+		return StackIter(data(), (std::ptrdiff_t)count, 0);
+	}
+
+	StackIter Stack::begin()const
+	{
+		return createIterator();
+	}
+
+	StackIter Stack::end()const
+	{
+		return StackIter(data(), (std::ptrdiff_t)count, (std::ptrdiff_t)count);
+	}
+
+	//How often operator== got away without comparing the elements
+	struct EqualityStats
+	{
+		std::atomic<unsigned long> calls;
+		std::atomic<unsigned long> lengthRejects;
+		std::atomic<unsigned long> fingerprintRejects;
+		std::atomic<unsigned long> sharedStorage;
+		std::atomic<unsigned long> fullCompares;
 	};
 
-	StackIter *Stack::createIterator()const
+	inline EqualityStats &equalityStats()
 	{
-		return new StackIter(this);
+		static EqualityStats stats;
+		return stats;
 	}
 
+	// 3. Clients may equally walk both stacks with iterators; with contiguous storage a length check, the
+	//    fingerprints and at most one block compare give the same answer much faster.
 	bool operator == (const Stack &l, const Stack &r)
 	{
-		// 3. Clients ask the container object to create an iterator object
-		StackIter *itl = l.createIterator();
-		StackIter *itr = r.createIterator();
+		EqualityStats &stats = equalityStats();
+		stats.calls.fetch_add(1, std::memory_order_relaxed);
+		if (l.size() != r.size())
+		{
+			stats.lengthRejects.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (l.getFingerprint() != r.getFingerprint())
+		{
+			stats.fingerprintRejects.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (l.sharesStorageWith(r))
+		{
+			stats.sharedStorage.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		stats.fullCompares.fetch_add(1, std::memory_order_relaxed);
+		return Simd::equal(l.data(), r.data(), l.size());
+	}
+
+	//Epoch-based reclamation for the lock-free stack. A thread announces the global epoch while it may hold
+	//pointers into a stack; a node is freed only after the epoch has advanced twice past its removal, when no
+	//thread can still be reading it. Because a node's memory is never reused while a reader could hold it, the
+	//head CAS cannot be fooled by a recycled address, which is what protects the stack from ABA.
+	class EpochDomain
+	{
+		public:
+		struct Node
+		{
+			int value;
+			Node *next;
+		};
 
-		// 4. Clients use the first(), isDone(), next(), and currentItem() protocol
-		for (itl->first(), itr->first(); !itl->isDone(); itl->next(), itr->next())
+		private:
+		enum { BAGS = 3, ADVANCE_EVERY = 64 };
+		static const uint64_t IDLE = ~0ULL;
+
+		struct Record
+		{
+			std::atomic<uint64_t> epoch;	// IDLE outside critical sections
+			std::atomic<bool> inUse;
+			uint64_t seen;
+			std::vector<Node*> bags[BAGS];
+			Record *next;
+		};
+
+		std::atomic<uint64_t> global;
+		std::atomic<Record*> records;
+
+		static void freeBag(std::vector<Node*> &bag)
+		{
+			for (size_t n = 0; n < bag.size(); n++)
+				delete bag[n];
+			bag.clear();
+		}
+
+		Record *acquire()
+		{
+			for (Record *r = records.load(std::memory_order_acquire); r; r = r->next)
+			{
+				bool expected = false;
+				if (!r->inUse.load(std::memory_order_relaxed) && r->inUse.compare_exchange_strong(expected, true))
+					return r;
+			}
+			Record *r = new Record;
+			r->epoch = IDLE;
+			r->inUse = true;
+			r->seen = 0;
+			r->next = records.load(std::memory_order_relaxed);
+			while (!records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed))
+				;
+			return r;
+		}
+
+		// A thread's record is handed back (bags and all) when the thread exits, for the next thread to reuse
+		struct Slot
+		{
+			Record *record;
+			Slot() : record(0)
+			{
+			}
+			~Slot()
+			{
+				if (record)
+					record->inUse.store(false, std::memory_order_release);
+			}
+		};
+
+		Record &self()
+		{
+			static thread_local Slot slot;
+			if (!slot.record)
+				slot.record = acquire();
+			return *slot.record;
+		}
+
+		void tryAdvance()
+		{
+			uint64_t e = global.load(std::memory_order_seq_cst);
+			for (Record *r = records.load(std::memory_order_acquire); r; r = r->next)
+			{
+				uint64_t announced = r->epoch.load(std::memory_order_seq_cst);
+				if (IDLE != announced && announced != e)
+					return;
+			}
+			global.compare_exchange_strong(e, e + 1);
+		}
+
+		EpochDomain()
+		{
+			global = 0;
+			records = 0;
+		}
+
+		public:
+		~EpochDomain()
+		{
+			Record *r = records.load();
+			while (r)
+			{
+				Record *next = r->next;
+				for (int b = 0; b < BAGS; b++)
+					freeBag(r->bags[b]);
+				delete r;
+				r = next;
+			}
+		}
+		static EpochDomain &instance()
+		{
+			static EpochDomain domain;
+			return domain;
+		}
+		void enter()
+		{
+			Record &r = self();
+			uint64_t e = global.load(std::memory_order_seq_cst);
+			r.epoch.store(e, std::memory_order_seq_cst);
+			if (r.seen != e)
+			{
+				// Whatever this thread retired three or more epochs ago can no longer be referenced
+				r.seen = e;
+				freeBag(r.bags[e % BAGS]);
+			}
+		}
+		void exit()
+		{
+			self().epoch.store(IDLE, std::memory_order_release);
+		}
+		// Call between enter() and exit().
+		void retire(Node *node)
+		{
+			Record &r = self();
+			std::vector<Node*> &bag = r.bags[r.seen % BAGS];
+			bag.push_back(node);
+			if (0 == bag.size() % ADVANCE_EVERY)
+				tryAdvance();
+		}
+	};
+
+	//Lock-free Treiber stack. When the head CAS fails under contention an operation backs off into an elimination
+	//array, where a push that is waiting hands its value straight to a pop and neither touches the head.
+	class ConcurrentStack
+	{
+		typedef EpochDomain::Node Node;
+		enum { ELIMINATION_SLOTS = 16, ELIMINATION_SPINS = 64 };
+		// Elimination slot: state in the top bits, the pushed value in the low 32
+		static const uint64_t EMPTY = 0, WAITING = 1ULL << 32, TAKEN = 2ULL << 32;
+
+		alignas(64) std::atomic<Node*> head;
+		alignas(64) std::atomic<uint64_t> slots[ELIMINATION_SLOTS];
+
+		static size_t slotFor()
+		{
+			static thread_local unsigned int seed = (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id());
+			seed = seed * 1103515245u + 12345u;
+			return (seed >> 16) % ELIMINATION_SLOTS;
+		}
+		bool eliminatePush(int in)
+		{
+			std::atomic<uint64_t> &slot = slots[slotFor()];
+			uint64_t expected = EMPTY;
+			if (!slot.compare_exchange_strong(expected, WAITING | (uint32_t)in))
+				return false;
+			for (int spin = 0; spin < ELIMINATION_SPINS; spin++)
+			{
+				if (TAKEN == slot.load(std::memory_order_acquire))
+				{
+					slot.store(EMPTY, std::memory_order_release);
+					return true;
+				}
+			}
+			expected = WAITING | (uint32_t)in;
+			if (slot.compare_exchange_strong(expected, EMPTY))
+				return false;
+			// A pop took the value just as the wait ran out
+			slot.store(EMPTY, std::memory_order_release);
+			return true;
+		}
+		bool eliminatePop(int &out)
+		{
+			std::atomic<uint64_t> &slot = slots[slotFor()];
+			uint64_t seen = slot.load(std::memory_order_acquire);
+			if ((seen & ~0xFFFFFFFFULL) != WAITING || !slot.compare_exchange_strong(seen, TAKEN))
+				return false;
+			out = (int)(uint32_t)seen;
+			return true;
+		}
+
+		public:
+		ConcurrentStack()
+		{
+			head = 0;
+			for (int s = 0; s < ELIMINATION_SLOTS; s++)
+				slots[s] = EMPTY;
+		}
+		~ConcurrentStack()
+		{
+			Node *n = head.load();
+			while (n)
+			{
+				Node *next = n->next;
+				delete n;
+				n = next;
+			}
+		}
+		ConcurrentStack(const ConcurrentStack &) = delete;
+		ConcurrentStack &operator=(const ConcurrentStack &) = delete;
+
+		void push(int in)
+		{
+			Node *n = new Node;
+			n->value = in;
+			for (;;)
+			{
+				n->next = head.load(std::memory_order_relaxed);
+				if (head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed))
+					return;
+				if (eliminatePush(in))
+				{
+					delete n;
+					return;
+				}
+			}
+		}
+		// False when the stack is empty.
+		bool tryPop(int &out)
+		{
+			EpochDomain &domain = EpochDomain::instance();
+			domain.enter();
+			for (;;)
+			{
+				Node *n = head.load(std::memory_order_acquire);
+				if (!n)
+				{
+					domain.exit();
+					return false;
+				}
+				if (head.compare_exchange_weak(n, n->next, std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					out = n->value;
+					domain.retire(n);
+					domain.exit();
+					return true;
+				}
+				if (eliminatePop(out))
+				{
+					domain.exit();
+					return true;
+				}
+			}
+		}
+		bool isEmpty() const
+		{
+			return 0 == head.load(std::memory_order_acquire);
+		}
+	};
+
+	//Parallel traversals over a Stack. The range is split with StackIter::trySplit() into balanced pieces of at
+	//least cutoff items, the pieces run on a fixed pool of threads, and their results are combined. Stacks
+	//smaller than the cutoff are traversed sequentially with the first/next/isDone protocol on the calling thread.
+	//The stacks must not be modified while a traversal is running.
+	class ParallelTraversal
+	{
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()> > tasks;
+		std::mutex lock;
+		std::condition_variable wake;
+		bool stopping;
+		size_t cutoff;
+
+		void work()
+		{
+			for (;;)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					wake.wait(guard, [this]() { return stopping || !tasks.empty(); });
+					if (tasks.empty())
+						return;
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				task();
+			}
+		}
+
+		// Splits until every piece is at most max(cutoff, size / (4 * threads)) items
+		std::vector<StackIter> split(StackIter whole) const
+		{
+			std::ptrdiff_t grain = std::max((std::ptrdiff_t)cutoff,
+				whole.remaining() / (std::ptrdiff_t)(4 * workers.size()) + 1);
+			std::vector<StackIter> pieces(1, whole);
+			for (size_t p = 0; p < pieces.size(); )
+			{
+				StackIter prefix;
+				if (pieces[p].remaining() > grain && pieces[p].trySplit(prefix))
+					pieces.insert(pieces.begin() + p, prefix);
+				else
+					p++;
+			}
+			return pieces;
+		}
+
+		// Runs leaf(p) for every piece on the pool and waits for all of them
+		template <typename Leaf>
+		void run(size_t pieces, Leaf leaf)
+		{
+			std::latch done((std::ptrdiff_t)pieces);
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				for (size_t p = 0; p < pieces; p++)
+					tasks.push_back([&leaf, &done, p]() { leaf(p); done.count_down(); });
+			}
+			wake.notify_all();
+			done.wait();
+		}
+
+		public:
+		ParallelTraversal(size_t threads = std::thread::hardware_concurrency(), size_t sequentialCutoff = 1 << 16)
+		{
+			stopping = false;
+			cutoff = sequentialCutoff ? sequentialCutoff : 1;
+			if (0 == threads)
+				threads = 1;
+			for (size_t t = 0; t < threads; t++)
+				workers.push_back(std::thread(&ParallelTraversal::work, this));
+		}
+		~ParallelTraversal()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (size_t t = 0; t < workers.size(); t++)
+				workers[t].join();
+		}
+		void setCutoff(size_t sequentialCutoff)
+		{
+			cutoff = sequentialCutoff ? sequentialCutoff : 1;
+		}
+
+		template <typename T, typename Op>
+		T reduce(const Stack &s, T identity, Op op)
+		{
+			if (s.size() < cutoff)
+			{
+				T acc = identity;
+				StackIter it = s.createIterator();
+				for (it.first(); !it.isDone(); it.next())
+					acc = op(acc, it.currentItem());
+				return acc;
+			}
+			std::vector<StackIter> pieces = split(s.createIterator());
+			std::vector<T> partial(pieces.size(), identity);
+			run(pieces.size(), [&](size_t p)
+				{
+					T acc = identity;
+					for (pieces[p].first(); !pieces[p].isDone(); pieces[p].next())
+						acc = op(acc, pieces[p].currentItem());
+					partial[p] = acc;
+				});
+			T acc = identity;
+			for (size_t p = 0; p < partial.size(); p++)
+				acc = op(acc, partial[p]);
+			return acc;
+		}
+
+		// Position of the first occurrence of value, or -1.
+		std::ptrdiff_t find(const Stack &s, int value)
+		{
+			if (s.size() < cutoff)
+			{
+				StackIter it = s.createIterator();
+				for (it.first(); !it.isDone(); it.next())
+					if (it.currentItem() == value)
+						return it - s.begin();
+				return -1;
+			}
+			std::vector<StackIter> pieces = split(s.createIterator());
+			std::atomic<std::ptrdiff_t> found((std::ptrdiff_t)s.size());
+			StackIter origin = s.begin();
+			run(pieces.size(), [&](size_t p)
+				{
+					for (pieces[p].first(); !pieces[p].isDone(); pieces[p].next())
+					{
+						std::ptrdiff_t at = pieces[p] - origin;
+						if (at >= found.load(std::memory_order_relaxed))
+							return;	// an earlier piece already has a match
+						if (pieces[p].currentItem() == value)
+						{
+							std::ptrdiff_t best = found.load();
+							while (at < best && !found.compare_exchange_weak(best, at))
+								;
+							return;
+						}
+					}
+				});
+			return found.load() == (std::ptrdiff_t)s.size() ? -1 : found.load();
+		}
+
+		// Same answer as operator==; the block compare of large stacks is spread over the pool.
+		bool equal(const Stack &l, const Stack &r)
+		{
+			if (l.size() < cutoff || l.size() != r.size() || l.getFingerprint() != r.getFingerprint()
+				|| l.sharesStorageWith(r))
+				return l == r;
+			equalityStats().calls.fetch_add(1, std::memory_order_relaxed);
+			equalityStats().fullCompares.fetch_add(1, std::memory_order_relaxed);
+			std::vector<StackIter> pieces = split(l.createIterator());
+			std::atomic<bool> differs(false);
+			StackIter origin = l.begin();
+			const int *other = r.data();
+			run(pieces.size(), [&](size_t p)
+				{
+					if (differs.load(std::memory_order_relaxed))
+						return;
+					pieces[p].first();
+					if (!Simd::equal(&*pieces[p], other + (pieces[p] - origin), pieces[p].remaining()))
+						differs.store(true, std::memory_order_relaxed);
+				});
+			return !differs.load();
+		}
+	};
+};
+
+namespace Bench
+{
+	//The original heap-allocating createIterator(). It is kept out of line so the optimizer cannot pair the new
+	//with the caller's delete and drop the allocation the baselines below are meant to pay for.
+#if defined(__GNUC__)
+	__attribute__((noinline))
+#endif
+	Demo1::StackIter *newIterator(const Demo1::Stack &s)
+	{
+		return new Demo1::StackIter(s.createIterator());
+	}
+
+	// 4. Clients use the first(), isDone(), next(), and currentItem() protocol.
+	//    This is the original heap-allocated form, kept as the baseline.
+	bool iteratorEqual(const Demo1::Stack &l, const Demo1::Stack &r)
+	{
+		Demo1::StackIter *itl = newIterator(l);
+		Demo1::StackIter *itr = newIterator(r);
+
+		for (itl->first(), itr->first(); !itl->isDone() && !itr->isDone(); itl->next(), itr->next())
 			if (itl->currentItem() != itr->currentItem())
 				break;
 
@@ -130,6 +920,233 @@ namespace Demo1
 
 		return ans;
 	}
+
+	//Equality of two equal million-element stacks, element by element through iterators and as a block compare
+	void equality()
+	{
+		const int n = 1 << 20;
+		const int rounds = 50;
+		Demo1::Stack a, b;
+		for (int i = 0; i < n; i++)
+		{
+			a.push(i * 7);
+			b.push(i * 7);
+		}
+
+		bool same = true;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+			same &= iteratorEqual(a, b);
+		double walked = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+			same &= (a == b);
+		double blocked = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double gb = 2.0 * n * sizeof(int) * rounds / 1e9;
+		std::cout << "equality of " << n << " elements (" << same << "): iterator " << gb / walked
+			<< " GB/s, block compare " << gb / blocked << " GB/s" << std::endl;
+	}
+
+	struct LockedStack
+	{
+		std::mutex lock;
+		Demo1::Stack stack;
+
+		void push(int in)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stack.push(in);
+		}
+		bool tryPop(int &out)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (stack.isEmpty())
+				return false;
+			out = stack.pop();
+			return true;
+		}
+	};
+
+	template <typename S>
+	double hammer(S &stack, unsigned int threads, int opsPerThread)
+	{
+		std::vector<std::thread> pool;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int t = 0; t < threads; t++)
+			pool.push_back(std::thread([&stack, opsPerThread, t]()
+				{
+					int out;
+					for (int op = 0; op < opsPerThread; op++)
+					{
+						stack.push((int)t * opsPerThread + op);
+						stack.tryPop(out);
+					}
+				}));
+		for (unsigned int t = 0; t < threads; t++)
+			pool[t].join();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return 2.0 * threads * opsPerThread / seconds / 1e6;
+	}
+
+	//Push/pop pairs from 1 up to all cores: lock-free stack against a mutex around Stack
+	void concurrent()
+	{
+		const int ops = 200000;
+		unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned int t = 1; ; t = std::min(t * 2, cores))
+		{
+			LockedStack locked;
+			Demo1::ConcurrentStack lockFree;
+			double m = hammer(locked, t, ops);
+			double f = hammer(lockFree, t, ops);
+			std::cout << t << " threads: mutex " << m << " Mops/s, lock-free " << f << " Mops/s" << std::endl;
+			if (t == cores)
+				break;
+		}
+	}
+
+	//Comparing equal-length stacks that differ in one item, with and without the fingerprint check
+	void fingerprints()
+	{
+		const int n = 1 << 20;
+		const int rounds = 200;
+		Demo1::Stack a, b;
+		for (int i = 0; i < n; i++)
+		{
+			a.push(i);
+			b.push(i == n / 2 ? -1 : i);
+		}
+
+		bool same = false;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+			same |= Demo1::Simd::equal(a.data(), b.data(), a.size());
+		double compared = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		unsigned long rejectsBefore = Demo1::equalityStats().fingerprintRejects;
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+			same |= (a == b);
+		double fingerprinted = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "unequal stacks of " << n << " items (" << same << "): block compare " << compared / rounds
+			<< " ns, with fingerprint " << fingerprinted / rounds << " ns ("
+			<< Demo1::equalityStats().fingerprintRejects - rejectsBefore << "/" << rounds << " rejected early)" << std::endl;
+	}
+
+	//Reduction, search and comparison of a large stack, sequential and through ParallelTraversal
+	void parallel()
+	{
+		const int n = 1 << 22;
+		Demo1::Stack a, b;
+		for (int i = 0; i < n; i++)
+		{
+			a.push(i & 0xFFFF);
+			b.push(i & 0xFFFF);
+		}
+		Demo1::ParallelTraversal pool;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		long long sum = 0;
+		Demo1::StackIter it = a.createIterator();
+		for (it.first(); !it.isDone(); it.next())
+			sum += it.currentItem();
+		std::ptrdiff_t at = std::find(a.begin(), a.end(), -1) - a.begin();
+		bool same = (a == b);
+		double sequential = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		long long psum = pool.reduce(a, 0LL, [](long long acc, long long x) { return acc + x; });
+		std::ptrdiff_t pat = pool.find(a, -1);
+		bool psame = pool.equal(a, b);
+		double parallel = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "sum/find/equal over " << n << " items (" << (sum == psum) << (at == n && pat == -1) << (same == psame)
+			<< "): sequential " << sequential << " ms, parallel (" << std::thread::hardware_concurrency() << " threads) "
+			<< parallel << " ms" << std::endl;
+	}
+
+	//Copying a large stack and changing each copy: pop only stays in the shared buffer, while pop then push has
+	//to move the copy to its own buffer and so costs as much as a deep copy
+	void copies()
+	{
+		const int n = 1 << 20;
+		const int forks = 1000;
+		Demo1::Stack base;
+		std::vector<int> flat;
+		for (int i = 0; i < n; i++)
+		{
+			base.push(i);
+			flat.push_back(i);
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		size_t total = 0;
+		for (int f = 0; f < forks; f++)
+		{
+			std::vector<int> copy(flat);
+			copy.pop_back();
+			total += copy.size();
+		}
+		double deep = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int f = 0; f < forks; f++)
+		{
+			Demo1::Stack copy(base);
+			copy.pop();
+			total += copy.size();
+		}
+		double shared = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int f = 0; f < forks; f++)
+		{
+			Demo1::Stack copy(base);
+			copy.pop();
+			copy.push(f);
+			total += copy.size();
+		}
+		double diverged = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << forks << " copies of " << n << " items (" << total << "): deep copy " << deep / forks
+			<< " ns/copy, shared + pop " << shared / forks << " ns/copy, shared + pop + push " << diverged / forks
+			<< " ns/copy" << std::endl;
+	}
+
+	//Many short traversals: heap-allocated iterators against value iterators on the stack
+	void traversal()
+	{
+		const int rounds = 1000000;
+		Demo1::Stack s;
+		for (int i = 0; i < 8; i++)
+			s.push(i);
+
+		long sum = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			Demo1::StackIter *it = newIterator(s);
+			for (it->first(); !it->isDone(); it->next())
+				sum += it->currentItem();
+			delete it;
+		}
+		double heap = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			Demo1::StackIter it = s.createIterator();
+			for (it.first(); !it.isDone(); it.next())
+				sum += it.currentItem();
+		}
+		double value = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << rounds << " traversals of " << s.size() << " items (" << sum << "): heap iterator "
+			<< heap / rounds << " ns, value iterator " << value / rounds << " ns" << std::endl;
+	}
 };
 
 int main()
@@ -151,8 +1168,61 @@ int main()
 		std::cout << "1 == 3 is " << (s1 == s3) << std::endl;
 		std::cout << "1 == 4 is " << (s1 == s4) << std::endl;
 		std::cout << "1 == 5 is " << (s1 == s5) << std::endl;
+		std::cout << "1 shares storage with 4: " << s1.sharesStorageWith(s4) << ", with 5: " << s1.sharesStorageWith(s5) << std::endl;
+		Demo1::EqualityStats &stats = Demo1::equalityStats();
+		std::cout << stats.calls << " comparisons: " << stats.lengthRejects << " rejected by length, "
+			<< stats.fingerprintRejects << " by fingerprint, " << stats.sharedStorage << " by shared storage, "
+			<< stats.fullCompares << " compared in full" << std::endl;
+
+		//The stack grows past the old fixed capacity of ten
+		Demo1::Stack big;
+		for (int i = 0; i < 100; i++)
+			big.push(i);
+		std::cout << "big has " << big.size() << " items, top " << big.pop() << std::endl;
+
+		//Value iterators work with range-for and the std:: algorithms
+		std::cout << "s4 holds";
+		for (int item : s4)
+			std::cout << " " << item;
+		std::cout << ", max " << *std::max_element(s4.begin(), s4.end())
+			<< ", sum of big " << std::reduce(std::execution::par_unseq, big.begin(), big.end()) << std::endl;
+
+		//A stack shared by several threads
+		Demo1::ConcurrentStack shared;
+		std::vector<std::thread> pushers;
+		for (int t = 0; t < 4; t++)
+			pushers.push_back(std::thread([&shared, t]()
+				{
+					for (int i = 0; i < 1000; i++)
+						shared.push(t * 1000 + i);
+				}));
+		for (int t = 0; t < 4; t++)
+			pushers[t].join();
+		long popped = 0, total = 0;
+		for (int item; shared.tryPop(item); popped++)
+			total += item;
+		std::cout << "shared stack popped " << popped << " items, sum " << total << std::endl;
+
+		//Traversals split across a pool; the tiny cutoff forces the parallel path even for big
+		Demo1::ParallelTraversal traversal(4, 8);
+		Demo1::Stack rebuilt;
+		for (int i = 0; i < 99; i++)
+			rebuilt.push(i);
+		std::cout << "parallel sum of big " << traversal.reduce(big, 0L, [](long acc, long x) { return acc + x; })
+			<< ", 42 found at " << traversal.find(big, 42) << ", big == rebuilt " << traversal.equal(big, rebuilt)
+			<< std::endl;
 
 		std::cout<<"End of Demo1"<<std::endl;
 	}
+	{
+		std::cout<<"Start of Bench1"<<std::endl;
+		Bench::equality();
+		Bench::traversal();
+		Bench::copies();
+		Bench::fingerprints();
+		Bench::parallel();
+		Bench::concurrent();
+		std::cout<<"End of Bench1"<<std::endl;
+	}
 	return 0;
 }
@@ -45,9 +45,44 @@ The program demonstrates the following:
 	For every new class hierarchy added that has two types for Unisys and IBM one extra virtual method will be introduced
 		in the factory.
 
+	Pooled products:
+		The acquire methods of the factories hand out products from per-type object pools, wrapped in a smart pointer
+		whose deleter returns the object to its pool. Pools are thread-local with a shared overflow, and report
+		hits, misses and the high-water mark of live objects.
+
+	Statically dispatched families:
+		Once the registry has resolved the vendor's factory, withFamily() instantiates the hot code for that
+		factory's family policy (UnisysFamily or IBMFamily), and FamilyManagers<Family> calls the concrete products
+		without any virtual dispatch. Vendors without a policy keep using their virtual factory.
+
+	Bulk creation:
+		createConfigurationManagers(n) and createOperationsManagers(n) build n products of the family in one
+		contiguous, cache-line aligned ProductBlock that is torn down with a single deallocation.
+
+	Factory registry:
+		Concrete factories register under their vendor name through a static FactoryRegistrar. The registry is
+		frozen into a perfect hash table before the first lookup, after which FactoryRegistry::create("IBM") is
+		a single lock-free probe.
+
+	Build:
+		g++ -std=c++17 -O2 -pthread AbstractFactory.cpp
 */
 
 #include<iostream>
+#include<vector>
+#include<memory>
+#include<mutex>
+#include<atomic>
+#include<thread>
+#include<chrono>
+#include<algorithm>
+#include<new>
+#include<string>
+#include<type_traits>
+#include<cstddef>
+#include<cstdint>
+#include<string_view>
+#include<typeinfo>
 
 namespace Demo1
 {
@@ -55,6 +90,7 @@ namespace Demo1
 	class ConfigurationManager
 	{
 	public:
+		virtual ~ConfigurationManager(){}
 		virtual void useConfigurationManager()=0;
 	};
 
@@ -81,6 +117,7 @@ namespace Demo1
 	class OperationsManager
 	{
 	public:
+		virtual ~OperationsManager(){}
 		virtual void useOperationsManager()=0;
 	};
 
@@ -105,12 +142,393 @@ namespace Demo1
 	};
 
 
+	//Per-product-type object pool. Released objects are destroyed but their memory is kept, first in a small
+	//thread-local free list and then in a global overflow list shared by all threads, and the next acquire
+	//constructs into it. Only when both lists are empty is fresh memory allocated (a miss).
+	//Each thread counts locally and publishes its counts every PUBLISH_EVERY operations, whenever it touches the
+	//overflow list, and when it exits, so the stats are exact once those points have been passed. The high-water
+	//mark adds each thread's local peak to the published live count, which is exact for a single thread and an
+	//upper bound when several threads publish at once.
+	template <typename T>
+	class ObjectPool
+	{
+		public:
+		struct Stats
+		{
+			std::atomic<unsigned long> hits;
+			std::atomic<unsigned long> misses;
+			std::atomic<long> live;
+			std::atomic<long> highWater;	// most objects alive at once
+		};
+
+		private:
+		enum { LOCAL_CAPACITY = 64, PUBLISH_EVERY = 256 };
+
+		struct Global
+		{
+			std::mutex lock;
+			std::vector<void*> free;
+			Stats stats;
+			~Global()
+			{
+				for (size_t f = 0; f < free.size(); f++)
+					::operator delete(free[f]);
+			}
+		};
+		static Global &global()
+		{
+			static Global g;
+			return g;
+		}
+
+		struct Local
+		{
+			std::vector<void*> free;
+			unsigned long hits;
+			unsigned long misses;
+			long live;		// change in live objects since the last publish
+			long peak;		// highest value live reached since the last publish
+			unsigned int unpublished;
+
+			Local() : hits(0), misses(0), live(0), peak(0), unpublished(0)
+			{
+			}
+			~Local()
+			{
+				Global &g = global();
+				publish(g, *this);
+				std::lock_guard<std::mutex> guard(g.lock);
+				g.free.insert(g.free.end(), free.begin(), free.end());
+			}
+		};
+		static Local &local()
+		{
+			static thread_local Local l;
+			return l;
+		}
+
+		static void publish(Global &g, Local &l)
+		{
+			g.stats.hits.fetch_add(l.hits, std::memory_order_relaxed);
+			g.stats.misses.fetch_add(l.misses, std::memory_order_relaxed);
+			long live = g.stats.live.fetch_add(l.live, std::memory_order_relaxed) + l.peak;
+			long high = g.stats.highWater.load(std::memory_order_relaxed);
+			while (live > high && !g.stats.highWater.compare_exchange_weak(high, live, std::memory_order_relaxed))
+				;
+			l.hits = 0;
+			l.misses = 0;
+			l.live = 0;
+			l.peak = 0;
+			l.unpublished = 0;
+		}
+
+		public:
+		static T *acquire()
+		{
+			Local &l = local();
+			void *memory;
+			if (l.free.empty())
+			{
+				// Refill half the local list from the overflow in one go
+				Global &g = global();
+				publish(g, l);
+				std::lock_guard<std::mutex> guard(g.lock);
+				size_t take = std::min(g.free.size(), (size_t)LOCAL_CAPACITY / 2);
+				l.free.insert(l.free.end(), g.free.end() - take, g.free.end());
+				g.free.resize(g.free.size() - take);
+			}
+			if (!l.free.empty())
+			{
+				memory = l.free.back();
+				l.free.pop_back();
+				l.hits++;
+			}
+			else
+			{
+				memory = ::operator new(sizeof(T));
+				l.misses++;
+			}
+			if (++l.live > l.peak)
+				l.peak = l.live;
+			if (++l.unpublished == PUBLISH_EVERY)
+				publish(global(), l);
+			return new (memory) T;
+		}
+		static void release(T *object)
+		{
+			Local &l = local();
+			object->~T();
+			l.live--;
+			if (l.free.size() >= LOCAL_CAPACITY)
+			{
+				// Spill half the local list to the overflow so other threads can use it
+				Global &g = global();
+				publish(g, l);
+				std::lock_guard<std::mutex> guard(g.lock);
+				g.free.insert(g.free.end(), l.free.end() - LOCAL_CAPACITY / 2, l.free.end());
+				l.free.resize(l.free.size() - LOCAL_CAPACITY / 2);
+			}
+			l.free.push_back(object);
+			if (++l.unpublished == PUBLISH_EVERY)
+				publish(global(), l);
+		}
+		// Publishes the calling thread's counts first.
+		static const Stats &stats()
+		{
+			publish(global(), local());
+			return global().stats;
+		}
+	};
+
+	//Deleter of the pooled smart pointer: hands the object back to the pool of its concrete type
+	template <typename Product>
+	struct PoolDeleter
+	{
+		void (*recycle)(Product *);
+
+		void operator()(Product *p) const
+		{
+			if (p)
+				recycle(p);
+		}
+	};
+
+	template <typename Product>
+	using PooledPtr = std::unique_ptr<Product, PoolDeleter<Product> >;
+
+	template <typename Product, typename Concrete>
+	PooledPtr<Product> makePooled()
+	{
+		PoolDeleter<Product> deleter = {[](Product *p) { ObjectPool<Concrete>::release(static_cast<Concrete*>(p)); }};
+		return PooledPtr<Product>(ObjectPool<Concrete>::acquire(), deleter);
+	}
+
+
+	//N products of one concrete type constructed side by side in a single cache-line aligned allocation.
+	//Indexing is a stride multiply, so iterating them is a linear walk of memory, and destroying the block is
+	//one pass of (virtual) destructors followed by one deallocation.
+	template <typename Product>
+	class ProductBlock
+	{
+		enum { ALIGNMENT = 64 };
+
+		char* memory;
+		size_t count;
+		size_t stride;
+		std::ptrdiff_t baseOffset;	// from the start of a concrete object to its Product subobject
+
+		void destroy()
+		{
+			for (size_t i = count; i > 0; i--)
+				(*this)[i - 1].~Product();
+			if (memory)
+				::operator delete(memory, std::align_val_t(ALIGNMENT));
+			memory = 0;
+			count = 0;
+		}
+
+		ProductBlock() : memory(0), count(0), stride(0), baseOffset(0)
+		{
+		}
+
+	public:
+		template <typename Concrete>
+		static ProductBlock make(size_t n)
+		{
+			static_assert(std::is_base_of<Product, Concrete>::value, "Concrete must derive from Product");
+			static_assert(alignof(Concrete) <= ALIGNMENT, "Concrete is over-aligned");
+			ProductBlock block;
+			block.stride = (sizeof(Concrete) + alignof(Concrete) - 1) / alignof(Concrete) * alignof(Concrete);
+			if (0 == n)
+				return block;
+			block.memory = static_cast<char*>(::operator new(n * block.stride, std::align_val_t(ALIGNMENT)));
+			for (; block.count < n; block.count++)
+			{
+				// A throwing constructor leaves count at the objects built so far, which the destructor unwinds
+				Concrete* c = new (block.memory + block.count * block.stride) Concrete;
+				block.baseOffset = reinterpret_cast<char*>(static_cast<Product*>(c)) - reinterpret_cast<char*>(c);
+			}
+			return block;
+		}
+		ProductBlock(ProductBlock&& other) noexcept
+			: memory(other.memory), count(other.count), stride(other.stride), baseOffset(other.baseOffset)
+		{
+			other.memory = 0;
+			other.count = 0;
+		}
+		ProductBlock& operator=(ProductBlock&& other) noexcept
+		{
+			if (this != &other)
+			{
+				destroy();
+				memory = other.memory;
+				count = other.count;
+				stride = other.stride;
+				baseOffset = other.baseOffset;
+				other.memory = 0;
+				other.count = 0;
+			}
+			return *this;
+		}
+		ProductBlock(const ProductBlock&) = delete;
+		ProductBlock& operator=(const ProductBlock&) = delete;
+		~ProductBlock()
+		{
+			destroy();
+		}
+		size_t size() const
+		{
+			return count;
+		}
+		Product& operator[](size_t i) const
+		{
+			return *reinterpret_cast<Product*>(memory + i * stride + baseOffset);
+		}
+	};
+
+
 	//Factory class declarations
 	class SystemManagementAbstractFactory
 	{
 	public:
+		virtual ~SystemManagementAbstractFactory(){}
 		virtual ConfigurationManager* createConfigurationManager() = 0;
 		virtual OperationsManager* createOpertionsManager() = 0;
+		virtual PooledPtr<ConfigurationManager> acquireConfigurationManager() = 0;
+		virtual PooledPtr<OperationsManager> acquireOperationsManager() = 0;
+		virtual ProductBlock<ConfigurationManager> createConfigurationManagers(size_t n) = 0;
+		virtual ProductBlock<OperationsManager> createOperationsManagers(size_t n) = 0;
+	};
+
+	//Vendor name -> factory registry. Each factory registers itself with a static FactoryRegistrar placed next to
+	//its class, so adding a vendor does not touch any central switch. freeze(), run by the first lookup at the
+	//latest, searches for a hash seed under which every registered name gets a slot of its own and publishes that
+	//table through an atomic pointer. From then on the table never changes and a lookup is one hash, one probe
+	//and one compare, without a lock. Registering after the freeze is refused.
+	class FactoryRegistry
+	{
+	public:
+		typedef SystemManagementAbstractFactory* (*Creator)();
+
+	private:
+		struct Entry
+		{
+			std::string name;
+			Creator create;
+		};
+		struct Table
+		{
+			uint64_t seed;
+			size_t mask;
+			std::vector<Entry> slots;
+		};
+
+		std::mutex lock;
+		std::vector<Entry> pending;
+		std::unique_ptr<const Table> table;
+		std::atomic<const Table*> frozen;
+
+		FactoryRegistry() : frozen(0)
+		{
+		}
+
+		static uint64_t hash(uint64_t seed, std::string_view name)
+		{
+			uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+			for (size_t i = 0; i < name.size(); i++)
+				h = (h ^ static_cast<unsigned char>(name[i])) * 1099511628211ULL;
+			h ^= h >> 32;
+			h *= 0xD6E8FEB86659FD93ULL;
+			return h ^ (h >> 32);
+		}
+
+	public:
+		static FactoryRegistry& instance()
+		{
+			static FactoryRegistry registry;
+			return registry;
+		}
+		bool add(const std::string& vendor, Creator create)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (frozen.load(std::memory_order_relaxed))
+				return false;
+			for (size_t i = 0; i < pending.size(); i++)
+				if (pending[i].name == vendor)
+					return false;
+			pending.push_back(Entry{vendor, create});
+			return true;
+		}
+		void freeze()
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (frozen.load(std::memory_order_relaxed))
+				return;
+			std::unique_ptr<Table> built(new Table);
+			size_t size = 1;
+			while (size < pending.size())
+				size <<= 1;
+			for (bool placed = false; !placed; size <<= 1)
+			{
+				//A few hundred seeds per size, then a sparser table makes a collision-free seed easy to find
+				for (uint64_t seed = 0; seed < 256 && !placed; seed++)
+				{
+					built->seed = seed;
+					built->mask = size - 1;
+					built->slots.assign(size, Entry{std::string(), 0});
+					placed = true;
+					for (size_t i = 0; i < pending.size() && placed; i++)
+					{
+						Entry& slot = built->slots[hash(seed, pending[i].name) & built->mask];
+						if (slot.create)
+							placed = false;
+						else
+							slot = pending[i];
+					}
+				}
+			}
+			table.reset(built.release());
+			pending.clear();
+			frozen.store(table.get(), std::memory_order_release);
+		}
+		Creator find(std::string_view vendor)
+		{
+			const Table* t = frozen.load(std::memory_order_acquire);
+			if (!t)
+			{
+				freeze();
+				t = frozen.load(std::memory_order_acquire);
+			}
+			const Entry& slot = t->slots[hash(t->seed, vendor) & t->mask];
+			return (slot.create && slot.name == vendor) ? slot.create : 0;
+		}
+		//Returns a new factory of the named vendor, or null when the vendor is unknown
+		SystemManagementAbstractFactory* create(std::string_view vendor)
+		{
+			Creator creator = find(vendor);
+			return creator ? creator() : 0;
+		}
+	};
+
+	//Registers Factory under a vendor name during static initialisation. A refused registration (a vendor name
+	//taken already, or a registry frozen by an earlier lookup, e.g. from another file's static initialiser) is
+	//reported on std::cerr, since nothing could catch an exception thrown here, and left in registered.
+	template <typename Factory>
+	struct FactoryRegistrar
+	{
+		bool registered;
+
+		static SystemManagementAbstractFactory* create()
+		{
+			return new Factory;
+		}
+		explicit FactoryRegistrar(const char* vendor)
+		{
+			registered = FactoryRegistry::instance().add(vendor, &create);
+			if (!registered)
+				std::cerr<<"FactoryRegistry: vendor "<<vendor<<" was not registered (name taken or registry frozen)"
+					<<std::endl;
+		}
 	};
 
 	//Type A Concrete Factory
@@ -125,7 +543,24 @@ namespace Demo1
 		{
 			return new UnisysOperationsManager;
 		}
+		virtual PooledPtr<ConfigurationManager> acquireConfigurationManager()
+		{
+			return makePooled<ConfigurationManager, UnisysConfigurationManager>();
+		}
+		virtual PooledPtr<OperationsManager> acquireOperationsManager()
+		{
+			return makePooled<OperationsManager, UnisysOperationsManager>();
+		}
+		virtual ProductBlock<ConfigurationManager> createConfigurationManagers(size_t n)
+		{
+			return ProductBlock<ConfigurationManager>::make<UnisysConfigurationManager>(n);
+		}
+		virtual ProductBlock<OperationsManager> createOperationsManagers(size_t n)
+		{
+			return ProductBlock<OperationsManager>::make<UnisysOperationsManager>(n);
+		}
 	};
+	static FactoryRegistrar<UnisysSMConcreteFactory> unisysRegistrar("Unisys");
 
 	//Type B Concrete Factory
 	class IBMSMConcreteFactory : public SystemManagementAbstractFactory
@@ -139,7 +574,306 @@ namespace Demo1
 		{
 			return new IBMOperationsManager;
 		}
+		virtual PooledPtr<ConfigurationManager> acquireConfigurationManager()
+		{
+			return makePooled<ConfigurationManager, IBMConfigurationManager>();
+		}
+		virtual PooledPtr<OperationsManager> acquireOperationsManager()
+		{
+			return makePooled<OperationsManager, IBMOperationsManager>();
+		}
+		virtual ProductBlock<ConfigurationManager> createConfigurationManagers(size_t n)
+		{
+			return ProductBlock<ConfigurationManager>::make<IBMConfigurationManager>(n);
+		}
+		virtual ProductBlock<OperationsManager> createOperationsManagers(size_t n)
+		{
+			return ProductBlock<OperationsManager>::make<IBMOperationsManager>(n);
+		}
+	};
+	static FactoryRegistrar<IBMSMConcreteFactory> ibmRegistrar("IBM");
+
+	//Statically dispatched product families. A family policy names the concrete types of one vendor, and
+	//FamilyManagers<Family> holds those products by value and calls them qualified by their concrete type, so
+	//the hot path has no virtual call left and can be inlined. The vendor is resolved once through the
+	//FactoryRegistry; withFamily() then instantiates the caller's code for the policy of that factory's family,
+	//and the virtual factory stays in use for any vendor without a policy.
+	struct UnisysFamily
+	{
+		typedef UnisysSMConcreteFactory FactoryType;
+		typedef UnisysConfigurationManager ConfigurationManagerType;
+		typedef UnisysOperationsManager OperationsManagerType;
 	};
+
+	struct IBMFamily
+	{
+		typedef IBMSMConcreteFactory FactoryType;
+		typedef IBMConfigurationManager ConfigurationManagerType;
+		typedef IBMOperationsManager OperationsManagerType;
+	};
+
+	template <typename Family>
+	class FamilyManagers
+	{
+		typedef typename Family::ConfigurationManagerType CM;
+		typedef typename Family::OperationsManagerType OM;
+		CM configurationManager;
+		OM operationsManager;
+	public:
+		void useConfigurationManager()
+		{
+			configurationManager.CM::useConfigurationManager();
+		}
+		void useOperationsManager()
+		{
+			operationsManager.OM::useOperationsManager();
+		}
+	};
+
+	//The families that have a static policy, matched against a factory by its dynamic type
+	template <typename... Families>
+	struct FamilyList
+	{
+		template <typename Fn>
+		static bool dispatch(const SystemManagementAbstractFactory& factory, Fn& fn)
+		{
+			return ((typeid(factory) == typeid(typename Families::FactoryType) ? (fn(Families()), true) : false) || ...);
+		}
+	};
+	typedef FamilyList<UnisysFamily, IBMFamily> StaticFamilies;
+
+	//Calls fn(Family()) with the policy of the family the factory builds; returns false when that family has
+	//no static policy, in which case the caller goes on with the factory's virtual interface
+	template <typename Fn>
+	bool withFamily(const SystemManagementAbstractFactory& factory, Fn fn)
+	{
+		return StaticFamilies::dispatch(factory, fn);
+	}
+};
+
+namespace Bench
+{
+	//Silences std::cout while a benchmark runs so the products' printing does not dominate
+	class Mute
+	{
+		std::ios_base::iostate saved;
+	public:
+		Mute()
+		{
+			saved = std::cout.rdstate();
+			std::cout.setstate(std::ios_base::badbit);
+		}
+		~Mute()
+		{
+			std::cout.clear(saved);
+		}
+	};
+
+	//Picking the factory for a configured vendor name: a chain of string compares against one registry probe
+	void registryLookup()
+	{
+		const int lookups = 10000000;
+		const std::string vendors[] = { "Unisys", "IBM", "HP", "IBM" };
+		Demo1::FactoryRegistry& registry = Demo1::FactoryRegistry::instance();
+		registry.freeze();
+		size_t found = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < lookups; i++)
+		{
+			const std::string& vendor = vendors[i & 3];
+			Demo1::FactoryRegistry::Creator creator = 0;
+			if ("Unisys" == vendor)
+				creator = &Demo1::FactoryRegistrar<Demo1::UnisysSMConcreteFactory>::create;
+			else if ("IBM" == vendor)
+				creator = &Demo1::FactoryRegistrar<Demo1::IBMSMConcreteFactory>::create;
+			found += (0 != creator);
+		}
+		double compares = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < lookups; i++)
+			found += (0 != registry.find(vendors[i & 3]));
+		double probes = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		std::cout<<"Vendor lookup: string compares "<<compares / lookups<<" ns, registry "<<probes / lookups
+			<<" ns ("<<found<<" found)"<<std::endl;
+	}
+
+	//A reconfiguration of thousands of managers: one heap node per manager against one ProductBlock
+	void bulkCreation()
+	{
+		const size_t n = 4096;
+		const int rounds = 1000;
+		Demo1::IBMSMConcreteFactory factory;
+		double nodes, block;
+		{
+			Mute mute;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+			{
+				std::vector<Demo1::OperationsManager*> managers(n);
+				for (size_t i = 0; i < n; i++)
+					managers[i] = factory.createOpertionsManager();
+				for (size_t i = 0; i < n; i++)
+					managers[i]->useOperationsManager();
+				for (size_t i = 0; i < n; i++)
+					delete managers[i];
+			}
+			nodes = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			for (int r = 0; r < rounds; r++)
+			{
+				Demo1::ProductBlock<Demo1::OperationsManager> managers = factory.createOperationsManagers(n);
+				for (size_t i = 0; i < managers.size(); i++)
+					managers[i].useOperationsManager();
+			}
+			block = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout<<n<<" managers created, used and destroyed: separate nodes "<<nodes / rounds<<" us, one block "
+			<<block / rounds<<" us"<<std::endl;
+	}
+
+	//Products that only count their uses, so the dispatch itself is what gets measured. Each keeps its count in
+	//a member of its own, and opaque() makes every call really produce the new count without forcing it through
+	//memory, so the inlined static calls cannot be folded into one addition after the loop. The counts are added
+	//to uses when the products go away.
+	unsigned long uses = 0;
+
+	template <typename T>
+	inline void opaque(T& value)
+	{
+#if defined(__GNUC__)
+		asm volatile("" : "+r"(value));
+#endif
+	}
+
+	template <int N>
+	class CountingConfigurationManager : public Demo1::ConfigurationManager
+	{
+		unsigned long count;
+	public:
+		CountingConfigurationManager() : count(0)
+		{
+		}
+		~CountingConfigurationManager()
+		{
+			uses += count;
+		}
+		void useConfigurationManager()
+		{
+			count += N;
+			opaque(count);
+		}
+	};
+
+	template <int N>
+	class CountingOperationsManager : public Demo1::OperationsManager
+	{
+		unsigned long count;
+	public:
+		CountingOperationsManager() : count(0)
+		{
+		}
+		~CountingOperationsManager()
+		{
+			uses += count;
+		}
+		void useOperationsManager()
+		{
+			count += N;
+			opaque(count);
+		}
+	};
+
+	struct CountingFamily
+	{
+		typedef CountingConfigurationManager<1> ConfigurationManagerType;
+		typedef CountingOperationsManager<1> OperationsManagerType;
+	};
+
+	//Per-call cost of using the products through the abstract interfaces and through the family policy
+	template <typename Family>
+	void familyDispatch(const char* vendor, Demo1::ConfigurationManager* cm, Demo1::OperationsManager* om)
+	{
+		const int calls = 10000000;
+		Demo1::FamilyManagers<Family> managers;
+		double virtualNs, staticNs;
+		{
+			Mute mute;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int c = 0; c < calls; c++)
+			{
+				cm->useConfigurationManager();
+				om->useOperationsManager();
+			}
+			virtualNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			for (int c = 0; c < calls; c++)
+			{
+				managers.useConfigurationManager();
+				managers.useOperationsManager();
+			}
+			staticNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		}
+		std::cout<<vendor<<": virtual "<<virtualNs / (2.0 * calls)<<" ns/call, static "<<staticNs / (2.0 * calls)
+			<<" ns/call"<<std::endl;
+	}
+
+	void familyDispatch()
+	{
+		Demo1::UnisysSMConcreteFactory unisys;
+		Demo1::SystemManagementAbstractFactory* factory = &unisys;
+		std::unique_ptr<Demo1::ConfigurationManager> cm(factory->createConfigurationManager());
+		std::unique_ptr<Demo1::OperationsManager> om(factory->createOpertionsManager());
+		familyDispatch<Demo1::UnisysFamily>("Unisys (printing)", cm.get(), om.get());
+
+		//Which counting product sits behind the interface is only known at run time
+		bool other = std::chrono::steady_clock::now().time_since_epoch().count() < 0;
+		std::unique_ptr<Demo1::ConfigurationManager> ccm(other ? (Demo1::ConfigurationManager*)new CountingConfigurationManager<2>
+			: new CountingConfigurationManager<1>);
+		std::unique_ptr<Demo1::OperationsManager> com(other ? (Demo1::OperationsManager*)new CountingOperationsManager<2>
+			: new CountingOperationsManager<1>);
+		familyDispatch<CountingFamily>("Counting products", ccm.get(), com.get());
+		ccm.reset();
+		com.reset();
+		std::cout<<"("<<uses<<" uses)"<<std::endl;
+	}
+
+	//Churning products: new/delete per product against the pooled acquire/release
+	void pooledChurn()
+	{
+		const int rounds = 1000000;
+		Demo1::UnisysSMConcreteFactory factory;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			Demo1::ConfigurationManager* cm = factory.createConfigurationManager();
+			Demo1::OperationsManager* om = factory.createOpertionsManager();
+			delete cm;
+			delete om;
+		}
+		double allocated = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			Demo1::PooledPtr<Demo1::ConfigurationManager> cm = factory.acquireConfigurationManager();
+			Demo1::PooledPtr<Demo1::OperationsManager> om = factory.acquireOperationsManager();
+		}
+		double pooled = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout<<rounds<<" product pairs: new/delete "<<allocated / rounds<<" ns, pooled "<<pooled / rounds<<" ns"<<std::endl;
+	}
+
+	template <typename T>
+	void report(const char* name)
+	{
+		const typename Demo1::ObjectPool<T>::Stats& stats = Demo1::ObjectPool<T>::stats();
+		std::cout<<name<<" pool: hits "<<stats.hits<<" misses "<<stats.misses<<" live "<<stats.live
+			<<" high-water "<<stats.highWater<<std::endl;
+	}
 };
 
 int main()
@@ -161,7 +895,84 @@ int main()
 		cm->useConfigurationManager();
 		om->useOperationsManager();
 	}
+	{
+		//Pooled products go back to their pool when the smart pointer lets go of them
+		Demo1::SystemManagementAbstractFactory* ibmSMFactory = new Demo1::IBMSMConcreteFactory;
+		for (int i = 0; i < 3; i++)
+		{
+			Demo1::PooledPtr<Demo1::ConfigurationManager> cm = ibmSMFactory->acquireConfigurationManager();
+			cm->useConfigurationManager();
+		}
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++)
+			threads.push_back(std::thread([ibmSMFactory]()
+				{
+					std::vector<Demo1::PooledPtr<Demo1::OperationsManager> > held;
+					for (int i = 0; i < 100; i++)
+						held.push_back(ibmSMFactory->acquireOperationsManager());
+				}));
+		for (size_t t = 0; t < threads.size(); t++)
+			threads[t].join();
+		Bench::report<Demo1::IBMConfigurationManager>("IBMConfigurationManager");
+		Bench::report<Demo1::IBMOperationsManager>("IBMOperationsManager");
+		delete ibmSMFactory;
+	}
+	{
+		//A whole fleet of managers in one contiguous block, freed in one go
+		Demo1::SystemManagementAbstractFactory* unisysSMFactory = new Demo1::UnisysSMConcreteFactory;
+		Demo1::ProductBlock<Demo1::ConfigurationManager> fleet = unisysSMFactory->createConfigurationManagers(3);
+		for (size_t i = 0; i < fleet.size(); i++)
+			fleet[i].useConfigurationManager();
+		delete unisysSMFactory;
+	}
+	{
+		//The factory is picked by vendor name; vendors registered themselves next to their classes
+		Demo1::FactoryRegistry::instance().freeze();
+		Demo1::SystemManagementAbstractFactory* factory = Demo1::FactoryRegistry::instance().create("IBM");
+		Demo1::OperationsManager* om = factory->createOpertionsManager();
+		om->useOperationsManager();
+		delete om;
+		delete factory;
+		if (!Demo1::FactoryRegistry::instance().create("HP"))
+			std::cout<<"No factory registered for HP"<<std::endl;
+	}
+	{
+		//The vendor from configuration is resolved once through the registry; the loop below is instantiated
+		//per family that has a static policy
+		std::string vendor = "IBM";
+		Demo1::SystemManagementAbstractFactory* factory = Demo1::FactoryRegistry::instance().create(vendor);
+		if (!factory)
+			std::cout<<"Unknown vendor "<<vendor<<std::endl;
+		else
+		{
+			bool isStatic = Demo1::withFamily(*factory, [](auto family)
+			{
+				Demo1::FamilyManagers<decltype(family)> managers;
+				for (int i = 0; i < 2; i++)
+				{
+					managers.useConfigurationManager();
+					managers.useOperationsManager();
+				}
+			});
+			if (!isStatic)
+			{
+				//A registered vendor without a static policy goes through its virtual factory
+				Demo1::ConfigurationManager* cm = factory->createConfigurationManager();
+				cm->useConfigurationManager();
+				delete cm;
+			}
+			delete factory;
+		}
+	}
 	std::cout<<"Demo1 ends"<<std::endl;
 
+	std::cout<<"Bench1 starts"<<std::endl;
+	Bench::pooledChurn();
+	Bench::familyDispatch();
+	Bench::bulkCreation();
+	Bench::registryLookup();
+	Bench::report<Demo1::UnisysConfigurationManager>("UnisysConfigurationManager");
+	std::cout<<"Bench1 ends"<<std::endl;
+
 	return 0;
 }
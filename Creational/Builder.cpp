@@ -29,10 +29,24 @@ The program demonstrates the Builder pattern.
 		-> Director notifies the builder whenever a part of the product should be built.
 		-> Builder handles requests from the director and adds parts to the product.
 		-> The client retrieves the product from the builder.
+
+	Build plans:
+		-> The director compiles each recipe once into a build plan, the ordered list of builder steps it calls.
+		-> intern() maps a recipe name to its cached plan; construct(PlanKey) then only walks the step pointers.
+		-> Plans are shared by all directors and threads; lookups take a shared lock, compiling a new one an exclusive lock.
+
+	Build:
+		g++ -std=c++17 -O2 -pthread Builder.cpp
 */
 
 #include<iostream>
 #include<string>
+#include<vector>
+#include<memory>
+#include<unordered_map>
+#include<shared_mutex>
+#include<mutex>
+#include<thread>
 
 class UnisysSystemManager
 {
@@ -81,29 +95,65 @@ public:
 };
 
 
+//A compiled recipe: the builder steps in the order the director calls them
+typedef void (SystemManagerBuilder::*BuildStep)();
+struct BuildPlan
+{
+	std::vector<BuildStep> steps;
+};
+//Interned recipe name; stays valid for the life of the program
+typedef const BuildPlan* PlanKey;
+
 class SystemManagerDirector
 {
 private:
 	SystemManagerBuilder* builder;
-public:
-	void setBuilder(SystemManagerBuilder* buiderPtr){builder = buiderPtr;}
-	void construct(std::string sys)
+
+	static std::shared_mutex& plansLock(){static std::shared_mutex lock; return lock;}
+	static std::unordered_map<std::string, std::unique_ptr<BuildPlan> >& plans()
+	{
+		static std::unordered_map<std::string, std::unique_ptr<BuildPlan> > cache;
+		return cache;
+	}
+	//The recipes; returns null for a system the director does not know
+	static std::unique_ptr<BuildPlan> compile(const std::string& sys)
 	{
+		std::unique_ptr<BuildPlan> plan(new BuildPlan);
 		if("Unisys" == sys)
-		{
-			//Builder handles requests from the director and adds parts to the product
-			builder->create();
-			builder->BuildPartA();
-			builder->BuildPartB();
-		}
+			plan->steps = {&SystemManagerBuilder::create, &SystemManagerBuilder::BuildPartA, &SystemManagerBuilder::BuildPartB};
 		else if ("IBM" == sys)
+			plan->steps = {&SystemManagerBuilder::create, &SystemManagerBuilder::BuildPartC, &SystemManagerBuilder::BuildPartD};
+		else
+			plan.reset();
+		return plan;
+	}
+public:
+	void setBuilder(SystemManagerBuilder* buiderPtr){builder = buiderPtr;}
+	//Returns the plan of the recipe, compiling it on first use; unknown systems share an empty plan and are not cached
+	static PlanKey intern(const std::string& sys)
+	{
+		static const BuildPlan empty;
 		{
-			//Builder handles requests from the director and adds parts to the product
-			builder->create();
-			builder->BuildPartC();
-			builder->BuildPartD();
+			std::shared_lock<std::shared_mutex> reader(plansLock());
+			auto found = plans().find(sys);
+			if(found != plans().end())
+				return found->second.get();
 		}
+		std::unique_ptr<BuildPlan> plan = compile(sys);
+		if(!plan)
+			return &empty;
+		std::unique_lock<std::shared_mutex> writer(plansLock());
+		//Another thread may have compiled it meanwhile, in which case its plan is kept
+		auto inserted = plans().emplace(sys, std::move(plan));
+		return inserted.first->second.get();
+	}
+	void construct(PlanKey plan)
+	{
+		//Builder handles requests from the director and adds parts to the product
+		for(BuildStep step : plan->steps)
+			(builder->*step)();
 	}
+	void construct(const std::string& sys){construct(intern(sys));}
 };
 
 int main()
@@ -125,5 +175,19 @@ int main()
 	IBMSystemManager* ism = ibmSMBuilder->getSystemManager();
 	ism->doWork();
 
+	//Recipes are looked up once and the plan reused for every further build, from any thread
+	PlanKey ibmPlan = SystemManagerDirector::intern("IBM");
+	std::thread worker([ibmPlan]()
+		{
+			IBMSystemManagerConcreteBuilder builder;
+			SystemManagerDirector director;
+			director.setBuilder(&builder);
+			director.construct(ibmPlan);
+			builder.getSystemManager()->doWork();
+		});
+	worker.join();
+	smCreator->construct(ibmPlan);
+	ibmSMBuilder->getSystemManager()->doWork();
+
 	return 0;
 }